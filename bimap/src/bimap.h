@@ -1,17 +1,687 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
 #include <type_traits>
 #include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
 #include <utility>
+#include <vector>
 
-template<typename Left, typename Right, typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>>
+namespace intrusive {
+    // Balancing of trees: a treap by random priorities, expected O(log n) depth and split/merge based bulk operations
+    struct treap_balancing;
+    // Weak AVL tree by ranks: height is at most 2 log n in the worst case, bulk operations fall back to linear
+    // rebuilds or to operations on single nodes
+    struct wavl_balancing;
+
+    // Compile-time options of bimap, derive from default_policy to change some of them.
+    struct default_policy {
+        using balancing = treap_balancing;
+        // Keep subtree sizes for order statistics
+        static constexpr bool order_statistics = false;
+        // Store each key right after links of its tree (see colocated_layout)
+        static constexpr bool colocated_keys = false;
+        // Count comparisons, descent depths and allocations (see bimap::statistics)
+        static constexpr bool statistics = false;
+        // Keep an order-independent hash of all pairs, updated by every insertion and erasure (see bimap::fingerprint)
+        static constexpr bool fingerprint = false;
+        // Hash of keys for the fingerprint. Set fingerprint_hash_exact if keys equivalent by the comparators
+        // always have equal hashes, then bimaps with different fingerprints are unequal without comparing pairs.
+        template<typename Key>
+        using fingerprint_hash = std::hash<Key>;
+        static constexpr bool fingerprint_hash_exact = false;
+    };
+
+    struct order_statistics_policy : default_policy {
+        static constexpr bool order_statistics = true;
+    };
+
+    struct colocated_policy : default_policy {
+        static constexpr bool colocated_keys = true;
+    };
+
+    struct statistics_policy : default_policy {
+        static constexpr bool statistics = true;
+    };
+
+    struct wavl_policy : default_policy {
+        using balancing = wavl_balancing;
+    };
+
+    struct fingerprint_policy : default_policy {
+        static constexpr bool fingerprint = true;
+    };
+
+    template<typename Left, typename Right, typename Policy = default_policy>
+    struct map_element;
+
+    template<typename T>
+    struct slab_allocator;
+}
+
+template<typename Left, typename Right, typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>,
+        typename Allocator = intrusive::slab_allocator<intrusive::map_element<Left, Right>>,
+        typename Policy = intrusive::default_policy>
 struct bimap;
 
 namespace intrusive {
-    // To generate priorities
-    std::mt19937 gen(std::random_device{}());
+    // To generate priorities.
+    // splitmix64 with a state per thread, so independent bimaps can be filled concurrently.
+    inline int next_priority() noexcept {
+        thread_local std::uint64_t state = (static_cast<std::uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}();
+        std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return static_cast<int>(static_cast<std::uint32_t>((z ^ (z >> 31)) >> 32));
+    }
+
+    // Hint to load the cache line of p, it is not dereferenced.
+    inline void prefetch(void const *p) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(p);
+#else
+        (void) p;
+#endif
+    }
+
+    // Memory pool for nodes of the same size.
+    // Nodes are cut from contiguous slabs and recycled through the free list.
+    // The node size is fixed by the first allocation, other sizes go to operator new.
+    struct slab_pool {
+        slab_pool() noexcept = default;
+
+        slab_pool(slab_pool const &) = delete;
+
+        slab_pool &operator=(slab_pool const &) = delete;
+
+        ~slab_pool() {
+            release();
+        }
+
+        void *allocate(std::size_t size, std::size_t align) {
+            if (node_size == 0) {
+                node_size = (std::max(size, sizeof(free_node)) + alignof(free_node) - 1) / alignof(free_node) * alignof(free_node);
+                node_align = std::max(align, alignof(free_node));
+            }
+            if (!fits(size, align)) {
+                return ::operator new(size, std::align_val_t(align));
+            }
+            if (free_list != nullptr) {
+                free_node *res = free_list;
+                free_list = res->next;
+                return res;
+            }
+            if (next == end) {
+                grow_();
+            }
+            void *res = next;
+            next += node_size;
+            return res;
+        }
+
+        void deallocate(void *p, std::size_t size, std::size_t align) noexcept {
+            if (!fits(size, align)) {
+                ::operator delete(p, std::align_val_t(align));
+            } else {
+                free_list = new(p) free_node{free_list};
+            }
+        }
+
+        // Frees all slabs at once, invalidating every node allocated from the pool.
+        void release() noexcept {
+            for (char *slab : slabs) {
+                ::operator delete(slab, std::align_val_t(node_align));
+            }
+            slabs.clear();
+            free_list = nullptr;
+            next = end = nullptr;
+            slab_capacity = 0;
+        }
+
+        // Takes over all slabs of other, so that nodes allocated from it can be freed here.
+        // Fails if node sizes differ. Other stays usable and empty.
+        bool absorb(slab_pool &other) {
+            if (other.node_size == 0) {
+                return true;
+            }
+            if (node_size == 0) {
+                node_size = other.node_size;
+                node_align = other.node_align;
+            }
+            if (node_size != other.node_size || node_align != other.node_align) {
+                return false;
+            }
+            slabs.insert(slabs.end(), other.slabs.begin(), other.slabs.end());
+            other.slabs.clear();
+            // The rest of other's current slab becomes free nodes
+            for (char *p = other.next; p != other.end; p += node_size) {
+                free_list = new(p) free_node{free_list};
+            }
+            while (other.free_list != nullptr) {
+                free_node *n = other.free_list;
+                other.free_list = n->next;
+                n->next = free_list;
+                free_list = n;
+            }
+            other.next = other.end = nullptr;
+            other.slab_capacity = 0;
+            return true;
+        }
+
+    private:
+        struct free_node {
+            free_node *next;
+        };
+
+        static constexpr std::size_t min_slab_capacity = 16;
+        static constexpr std::size_t max_slab_capacity = 4096;
+
+        bool fits(std::size_t size, std::size_t align) const noexcept {
+            return size <= node_size && align <= node_align;
+        }
+
+        void grow_() {
+            // Reserved first, so push_back cannot throw and leak the slab; geometrically, so growth stays amortized O(1)
+            if (slabs.size() == slabs.capacity()) {
+                slabs.reserve(std::max<std::size_t>(2 * slabs.size(), 1));
+            }
+            std::size_t capacity = slab_capacity == 0 ? min_slab_capacity : std::min(2 * slab_capacity, max_slab_capacity);
+            char *slab = static_cast<char *>(::operator new(capacity * node_size, std::align_val_t(node_align)));
+            slabs.push_back(slab);
+            slab_capacity = capacity;
+            next = slab;
+            end = slab + capacity * node_size;
+        }
+
+    private:
+        std::size_t node_size = 0;
+        std::size_t node_align = 0;
+        std::size_t slab_capacity = 0;
+        free_node *free_list = nullptr;
+        char *next = nullptr;
+        char *end = nullptr;
+        std::vector<char *> slabs;
+    };
+
+    // Tag of an allocator without memory yet, it gets a pool of its own by the first allocation.
+    struct lazy_pool_t {
+        explicit lazy_pool_t() = default;
+    };
+
+    inline constexpr lazy_pool_t lazy_pool{};
+
+    // Allocator of a new empty container: a lazy one if A supports it, so that an empty container allocates nothing.
+    template<typename A>
+    A unallocated() noexcept(std::is_constructible_v<A, lazy_pool_t> ? std::is_nothrow_constructible_v<A, lazy_pool_t>
+                                                                     : std::is_nothrow_default_constructible_v<A>) {
+        if constexpr (std::is_constructible_v<A, lazy_pool_t>) {
+            return A(lazy_pool);
+        } else {
+            return A();
+        }
+    }
+
+    // Allocator of single nodes backed by slab_pool.
+    // Copies (and rebound copies) share the pool, copies of a container get a fresh one.
+    // A lazy allocator (and a moved-from one) creates its pool by the first allocation, copies made before that
+    // do not share it, so containers hand out their allocators by share().
+    // Containers sharing a pool must not be modified concurrently.
+    template<typename T>
+    struct slab_allocator {
+        using value_type = T;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        template<typename U>
+        struct rebind {
+            using other = slab_allocator<U>;
+        };
+
+        slab_allocator()
+                : pool(std::make_shared<slab_pool>()) {}
+
+        explicit slab_allocator(lazy_pool_t) noexcept {}
+
+        template<typename U>
+        slab_allocator(slab_allocator<U> const &other) noexcept
+                : pool(other.pool) {}
+
+        T *allocate(std::size_t n) {
+            if (pool == nullptr) {
+                pool = std::make_shared<slab_pool>();
+            }
+            return static_cast<T *>(pool->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T *p, std::size_t n) noexcept {
+            pool->deallocate(p, n * sizeof(T), alignof(T));
+        }
+
+        slab_allocator select_on_container_copy_construction() const {
+            return slab_allocator();
+        }
+
+        // A copy sharing the pool, a lazy pool is created now.
+        // Const users of one allocator may call it concurrently.
+        slab_allocator share() const {
+            std::shared_ptr<slab_pool> current = std::atomic_load(&pool);
+            if (current == nullptr) {
+                std::shared_ptr<slab_pool> fresh = std::make_shared<slab_pool>();
+                if (std::atomic_compare_exchange_strong(&pool, &current, fresh)) {
+                    current = std::move(fresh);
+                }
+            }
+            slab_allocator res(lazy_pool);
+            res.pool = std::move(current);
+            return res;
+        }
+
+        // Frees the whole pool if nobody else uses it, a lazy one has nothing to free.
+        // Returns whether the memory was released.
+        bool release() noexcept {
+            if (pool == nullptr) {
+                return true;
+            }
+            if (pool.use_count() == 1) {
+                pool->release();
+                return true;
+            }
+            return false;
+        }
+
+        // Takes over the pool of other if nobody else uses it (see slab_pool::absorb).
+        // Returns whether nodes of other can be freed by this allocator now.
+        bool absorb(slab_allocator &other) {
+            if (pool == other.pool || other.pool == nullptr) {
+                return true;
+            }
+            if (pool == nullptr && other.pool.use_count() == 1) {
+                pool = std::move(other.pool);
+                return true;
+            }
+            return other.pool.use_count() == 1 && pool->absorb(*other.pool);
+        }
+
+        template<typename U>
+        bool operator==(slab_allocator<U> const &other) const noexcept {
+            return pool == other.pool;
+        }
+
+        template<typename U>
+        bool operator!=(slab_allocator<U> const &other) const noexcept {
+            return pool != other.pool;
+        }
+
+    private:
+        // Null until the first allocation of a lazy allocator
+        mutable std::shared_ptr<slab_pool> pool;
+
+        template<typename U>
+        friend
+        struct slab_allocator;
+    };
+
+    template<typename A, typename = void>
+    struct has_release : std::false_type {};
+
+    template<typename A>
+    struct has_release<A, std::void_t<decltype(std::declval<A &>().release())>> : std::true_type {};
+
+    template<typename A, typename = void>
+    struct has_share : std::false_type {};
+
+    template<typename A>
+    struct has_share<A, std::void_t<decltype(std::declval<A const &>().share())>> : std::true_type {};
+
+    template<typename A, typename = void>
+    struct has_absorb : std::false_type {};
+
+    template<typename A>
+    struct has_absorb<A, std::void_t<decltype(std::declval<A &>().absorb(std::declval<A &>()))>> : std::true_type {};
+
+    // Binary image of a bimap with trivially copyable keys, written by bimap::save:
+    // the header, then lefts in the left order, rights in the right order and two std::uint32_t permutations,
+    // left_to_right[i] is the position in rights of the element paired with lefts[i], right_to_left is the inverse.
+    // Keys are stored as they are in memory, so an image is only read where it was written
+    // (the same byte order and key layout), sections are aligned to image_layout::alignment.
+    struct image_header {
+        static constexpr char magic_value[8] = {'b', 'i', 'm', 'a', 'p', 'i', 'm', '1'};
+        static constexpr std::uint32_t byte_order_value = 0x01020304;
+
+        char magic[8];
+        std::uint32_t byte_order;
+        std::uint32_t left_size;
+        std::uint32_t right_size;
+        std::uint32_t reserved;
+        std::uint64_t count;
+
+        static image_header make(std::size_t left_size, std::size_t right_size, std::size_t count) noexcept {
+            image_header h{};
+            std::memcpy(h.magic, magic_value, sizeof(magic_value));
+            h.byte_order = byte_order_value;
+            h.left_size = static_cast<std::uint32_t>(left_size);
+            h.right_size = static_cast<std::uint32_t>(right_size);
+            h.count = count;
+            return h;
+        }
+
+        bool valid(std::size_t left_size_expected, std::size_t right_size_expected) const noexcept {
+            return std::memcmp(magic, magic_value, sizeof(magic_value)) == 0 && byte_order == byte_order_value &&
+                   left_size == left_size_expected && right_size == right_size_expected &&
+                   count <= std::numeric_limits<std::uint32_t>::max();
+        }
+    };
+
+    // Offsets of the sections of an image from its beginning.
+    struct image_layout {
+        static constexpr std::size_t alignment = 64;
+
+        image_layout(std::size_t count, std::size_t left_size, std::size_t right_size) noexcept
+                : lefts(align(sizeof(image_header))),
+                  rights(align(lefts + count * left_size)),
+                  left_to_right(align(rights + count * right_size)),
+                  right_to_left(align(left_to_right + count * sizeof(std::uint32_t))),
+                  total(align(right_to_left + count * sizeof(std::uint32_t))) {}
+
+        static std::size_t align(std::size_t offset) noexcept {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+
+        std::size_t lefts;
+        std::size_t rights;
+        std::size_t left_to_right;
+        std::size_t right_to_left;
+        std::size_t total;
+    };
+
+    // Whether the index sections of an image are permutations inverse to each other.
+    // Then left_to_right is injective, so it is a permutation, and right_to_left is its inverse.
+    inline bool valid_permutations(std::uint32_t const *left_to_right, std::uint32_t const *right_to_left,
+                                   std::size_t n) noexcept {
+        for (std::size_t i = 0; i < n; ++i) {
+            if (left_to_right[i] >= n || right_to_left[left_to_right[i]] != i) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Collects small writes of keys into big ones and pads sections of an image with zeros.
+    struct image_writer {
+        static constexpr std::size_t capacity = std::size_t(1) << 16;
+
+        explicit image_writer(std::ostream &out)
+                : out(out) {
+            buffer.reserve(capacity);
+        }
+
+        void write(void const *data, std::size_t bytes) {
+            if (buffer.size() + bytes > capacity) {
+                flush();
+            }
+            char const *p = static_cast<char const *>(data);
+            if (bytes > capacity) {
+                out.write(p, static_cast<std::streamsize>(bytes));
+            } else {
+                buffer.insert(buffer.end(), p, p + bytes);
+            }
+            written += bytes;
+        }
+
+        void pad_to(std::size_t offset) {
+            static constexpr char zeros[image_layout::alignment] = {};
+            write(zeros, offset - written);
+        }
+
+        void flush() {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+
+    private:
+        std::ostream &out;
+        std::vector<char> buffer;
+        std::size_t written = 0;
+    };
+
+    // Counter of Policy::statistics. Increments are a relaxed load and store rather than an atomic addition,
+    // so they stay cheap; concurrent readers of a const bimap may lose some of them, but never race.
+    struct stat_counter {
+        void add(std::uint64_t n = 1) noexcept {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        void raise_to(std::uint64_t n) noexcept {
+            if (value.load(std::memory_order_relaxed) < n) {
+                value.store(n, std::memory_order_relaxed);
+            }
+        }
+
+        std::uint64_t get() const noexcept {
+            return value.load(std::memory_order_relaxed);
+        }
+
+        void reset() noexcept {
+            value.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<std::uint64_t> value{0};
+    };
+
+    // Comparisons made by the current thread in maps with Policy::statistics,
+    // an operation of bimap takes the difference over its duration.
+    inline std::uint64_t &thread_comparisons() noexcept {
+        thread_local std::uint64_t count = 0;
+        return count;
+    }
+
+    // Number of operations of bimap the current thread is inside of, nested ones are parts of the outer.
+    inline std::size_t &thread_operation_depth() noexcept {
+        thread_local std::size_t depth = 0;
+        return depth;
+    }
+
+    enum operation_kind : std::size_t {
+        lookup_operation, insert_operation, erase_operation, operation_kinds
+    };
+
+    struct operation_counters {
+        stat_counter count;
+        stat_counter comparisons;
+        stat_counter max_comparisons;
+    };
+
+    // Counters of a map, an empty base of it unless Policy::statistics is set.
+    template<bool Enabled>
+    struct map_counters {};
+
+    template<>
+    struct map_counters<true> {
+        static constexpr std::size_t depth_buckets = 64;
+
+        mutable stat_counter comparisons;
+        mutable stat_counter depths[depth_buckets];
+        // Operations of bimap which started from this side
+        mutable operation_counters operations[operation_kinds];
+        // Nodes of bimap are counted by its left side
+        mutable stat_counter allocations;
+        mutable stat_counter frees;
+    };
+
+    // Accounts an operation of bimap and the comparisons made during it.
+    template<bool Enabled>
+    struct operation_scope {
+        explicit operation_scope(operation_counters *) noexcept {}
+
+        // User-provided, so that unused scopes are not warned about
+        ~operation_scope() {}
+    };
+
+    template<>
+    struct operation_scope<true> {
+        explicit operation_scope(operation_counters *counters) noexcept
+                : counters(counters), start(thread_comparisons()), outer(thread_operation_depth()++ == 0) {}
+
+        operation_scope(operation_scope const &) = delete;
+
+        operation_scope &operator=(operation_scope const &) = delete;
+
+        ~operation_scope() {
+            --thread_operation_depth();
+            if (outer) {
+                std::uint64_t made = thread_comparisons() - start;
+                counters->count.add();
+                counters->comparisons.add(made);
+                counters->max_comparisons.raise_to(made);
+            }
+        }
+
+    private:
+        operation_counters *counters;
+        std::uint64_t start;
+        bool outer;
+    };
+
+    // Snapshots of counters of bimap with Policy::statistics.
+    struct operation_statistics {
+        std::uint64_t count = 0;
+        std::uint64_t comparisons = 0;
+        // The most comparisons made by one operation
+        std::uint64_t max_comparisons = 0;
+    };
+
+    struct side_statistics {
+        // lookups are find, at, lower_bound and upper_bound; insert is accounted to the left side
+        operation_statistics lookups;
+        operation_statistics insertions;
+        operation_statistics erasures;
+        // All comparator invocations, including ones of bulk operations
+        std::uint64_t comparisons = 0;
+        // depth_histogram[d] is the number of descents from the root which visited d nodes (finger searches
+        // count compared nodes only), the last bucket also takes deeper ones
+        std::vector<std::uint64_t> depth_histogram;
+        // Height of the tree when the snapshot was taken
+        std::size_t max_depth = 0;
+    };
+
+    struct bimap_statistics {
+        side_statistics left;
+        side_statistics right;
+        std::size_t size = 0;
+        std::uint64_t allocations = 0;
+        std::uint64_t frees = 0;
+
+        // Writes the snapshot in the Prometheus text format: a "name{labels} value" line per sample.
+        void dump(std::ostream &out, std::string const &prefix = "bimap") const {
+            out << prefix << "_size " << size << '\n';
+            out << prefix << "_allocations_total " << allocations << '\n';
+            out << prefix << "_frees_total " << frees << '\n';
+            dump_side_(out, prefix, "left", left);
+            dump_side_(out, prefix, "right", right);
+        }
+
+    private:
+        static void dump_side_(std::ostream &out, std::string const &prefix, char const *side,
+                               side_statistics const &s) {
+            std::string labels = std::string("side=\"") + side + '"';
+            std::pair<char const *, operation_statistics const &> ops[] = {
+                    {"lookup", s.lookups}, {"insert", s.insertions}, {"erase", s.erasures}};
+            for (auto const &op : ops) {
+                std::string op_labels = '{' + labels + ",op=\"" + op.first + "\"} ";
+                out << prefix << "_operations_total" << op_labels << op.second.count << '\n';
+                out << prefix << "_operation_comparisons_total" << op_labels << op.second.comparisons << '\n';
+                out << prefix << "_operation_comparisons_max" << op_labels << op.second.max_comparisons << '\n';
+            }
+            out << prefix << "_comparisons_total{" << labels << "} " << s.comparisons << '\n';
+            out << prefix << "_max_depth{" << labels << "} " << s.max_depth << '\n';
+            // The last bucket is not bounded, so it is only a part of +Inf
+            std::size_t last = s.depth_histogram.empty() ? 0 : s.depth_histogram.size() - 1;
+            while (last > 0 && s.depth_histogram[last - 1] == 0) {
+                --last;
+            }
+            std::uint64_t cumulative = 0;
+            for (std::size_t d = 0; d < last; ++d) {
+                cumulative += s.depth_histogram[d];
+                out << prefix << "_descent_depth_bucket{" << labels << ",le=\"" << d << "\"} " << cumulative << '\n';
+            }
+            for (std::size_t d = last; d < s.depth_histogram.size(); ++d) {
+                cumulative += s.depth_histogram[d];
+            }
+            out << prefix << "_descent_depth_bucket{" << labels << ",le=\"+Inf\"} " << cumulative << '\n';
+            out << prefix << "_descent_depth_count{" << labels << "} " << cumulative << '\n';
+        }
+    };
+
+    // Fingerprint of a bimap, an empty base of it unless Policy::fingerprint is set.
+    template<bool Enabled>
+    struct pair_fingerprint {};
+
+    template<>
+    struct pair_fingerprint<true> {
+        // Sum of pair_hash of all pairs, so a pair is added and removed in O(1) regardless of the order
+        std::uint64_t fingerprint_value = 0;
+    };
+
+    // Finalizer of MurmurHash3: every bit of h affects every bit of the result.
+    inline std::size_t mix_hash(std::size_t h) noexcept {
+        std::uint64_t z = h;
+        z = (z ^ (z >> 33)) * 0xFF51AFD7ED558CCDull;
+        z = (z ^ (z >> 33)) * 0xC4CEB9FE1A85EC53ull;
+        return static_cast<std::size_t>(z ^ (z >> 33));
+    }
+
+    template<typename Policy = default_policy, typename Left, typename Right>
+    std::uint64_t pair_hash(Left const &left, Right const &right) noexcept {
+        using left_hash = typename Policy::template fingerprint_hash<Left>;
+        using right_hash = typename Policy::template fingerprint_hash<Right>;
+        return mix_hash(left_hash()(left) + mix_hash(right_hash()(right)));
+    }
+
+    template<typename Key, typename Compare>
+    constexpr bool standard_order = std::is_same_v<Compare, std::less<Key>> || std::is_same_v<Compare, std::less<>> ||
+                                    std::is_same_v<Compare, std::greater<Key>> ||
+                                    std::is_same_v<Compare, std::greater<>>;
+
+    // Whether keys equivalent by Compare are exactly the ones equal by ==, so they can be compared in bulk.
+    // Floating point keys are left out: NaN is equivalent to everything by < but equal to nothing by ==.
+    template<typename Key, typename Compare>
+    constexpr bool plain_equality = (std::is_integral_v<Key> || std::is_enum_v<Key>) && standard_order<Key, Compare>;
+
+    template<typename T>
+    constexpr bool is_basic_string = false;
+
+    template<typename Char, typename Traits, typename Alloc>
+    constexpr bool is_basic_string<std::basic_string<Char, Traits, Alloc>> = true;
+
+    // Whether keys equivalent by Compare always have equal hashes by Hash.
+    template<typename Key, typename Compare, typename Hash>
+    constexpr bool exact_hash = std::is_same_v<Hash, std::hash<Key>> &&
+                                (plain_equality<Key, Compare> || (is_basic_string<Key> && standard_order<Key, Compare>));
+
+    // No branches inside and a fixed number of iterations, so the loop is vectorized even at -O2.
+    template<typename Key, std::size_t N>
+    bool equal_keys(Key const (&a)[N], Key const (&b)[N]) noexcept {
+        unsigned diff = 0;
+        for (std::size_t i = 0; i < N; ++i) {
+            diff |= a[i] != b[i];
+        }
+        return diff == 0;
+    }
 
     struct tag_left;
     struct tag_right;
@@ -47,7 +717,7 @@ namespace intrusive {
 
         node &operator=(node const &) = delete;
 
-        template<typename Left, typename Right>
+        template<typename Left, typename Right, typename Policy>
         friend
         struct map_element;
 
@@ -84,39 +754,156 @@ namespace intrusive {
         return static_cast<T const &>(static_cast<node<Tag> const &>(base));
     }
 
-    template<typename Left, typename Right>
-    struct map_element : node<tag_left>, node<tag_right> {
+    // Size of the subtree in the tree of Tag, empty if it is not needed.
+    template<typename Tag, bool Enabled>
+    struct size_hook {};
+
+    template<typename Tag>
+    struct size_hook<Tag, true> {
+        std::size_t subtree_size = 1;
+    };
+
+    template<typename Element, typename Tag>
+    std::size_t subtree_size(node_base const *n) noexcept {
+        return n == nullptr ? 0 : static_cast<size_hook<Tag, true> const &>(from_base<Element, Tag>(*n)).subtree_size;
+    }
+
+    // Links of both trees go first, then both keys.
+    template<typename Left, typename Right, bool OrderStatistics>
+    struct separate_layout : node<tag_left>, node<tag_right>,
+                             size_hook<tag_left, OrderStatistics>, size_hook<tag_right, OrderStatistics> {
+        separate_layout() = default;
+
+        template<typename L, typename R>
+        separate_layout(L &&left, R &&right)
+                : left(std::forward<L>(left)), right(std::forward<R>(right)) {}
+
+        // Keys are constructed in place from the tuples of arguments
+        template<typename... LeftArgs, typename... RightArgs>
+        separate_layout(std::piecewise_construct_t, std::tuple<LeftArgs...> &&left_args,
+                        std::tuple<RightArgs...> &&right_args)
+                : left(std::make_from_tuple<Left>(std::move(left_args))),
+                  right(std::make_from_tuple<Right>(std::move(right_args))) {}
+
+        Left const &get_left() const noexcept {
+            return left;
+        }
+
+        Right const &get_right() const noexcept {
+            return right;
+        }
+
+    private:
+        Left left;
+        Right right;
+    };
+
+    // Links of one tree together with its key.
+    template<typename Tag, typename Key, bool OrderStatistics>
+    struct keyed_node : node<Tag>, size_hook<Tag, OrderStatistics> {
+        keyed_node() = default;
+
+        template<typename K>
+        explicit keyed_node(K &&key)
+                : key(std::forward<K>(key)) {}
+
+        template<typename... Args>
+        keyed_node(std::piecewise_construct_t, std::tuple<Args...> &&args)
+                : key(std::make_from_tuple<Key>(std::move(args))) {}
+
+        Key const &get_key() const noexcept {
+            return key;
+        }
+
+    private:
+        Key key;
+    };
+
+    // Each key goes right after links of its tree, so a descent does not jump from links to the key.
+    template<typename Left, typename Right, bool OrderStatistics>
+    struct colocated_layout : keyed_node<tag_left, Left, OrderStatistics>, keyed_node<tag_right, Right, OrderStatistics> {
+        colocated_layout() = default;
+
+        template<typename L, typename R>
+        colocated_layout(L &&left, R &&right)
+                : keyed_node<tag_left, Left, OrderStatistics>(std::forward<L>(left)),
+                  keyed_node<tag_right, Right, OrderStatistics>(std::forward<R>(right)) {}
+
+        template<typename... LeftArgs, typename... RightArgs>
+        colocated_layout(std::piecewise_construct_t, std::tuple<LeftArgs...> &&left_args,
+                         std::tuple<RightArgs...> &&right_args)
+                : keyed_node<tag_left, Left, OrderStatistics>(std::piecewise_construct, std::move(left_args)),
+                  keyed_node<tag_right, Right, OrderStatistics>(std::piecewise_construct, std::move(right_args)) {}
+
+        Left const &get_left() const noexcept {
+            return keyed_node<tag_left, Left, OrderStatistics>::get_key();
+        }
+
+        Right const &get_right() const noexcept {
+            return keyed_node<tag_right, Right, OrderStatistics>::get_key();
+        }
+    };
+
+    template<typename Left, typename Right, typename Policy>
+    using element_layout = std::conditional_t<Policy::colocated_keys,
+            colocated_layout<Left, Right, Policy::order_statistics>,
+            separate_layout<Left, Right, Policy::order_statistics>>;
+
+    template<typename Left, typename Right, typename Policy>
+    struct map_element : element_layout<Left, Right, Policy> {
         map_element() noexcept {}
 
         template<typename L, typename R>
-        map_element(L &&left, R &&right, int priority) noexcept
-                : left(std::forward<L>(left)), right(std::forward<R>(right)), priority(priority) {}
+        map_element(L &&left, R &&right, int priority)
+                : element_layout<Left, Right, Policy>(std::forward<L>(left), std::forward<R>(right)), priority(priority) {}
+
+        template<typename... LeftArgs, typename... RightArgs>
+        map_element(std::piecewise_construct_t, std::tuple<LeftArgs...> &&left_args,
+                    std::tuple<RightArgs...> &&right_args, int priority)
+                : element_layout<Left, Right, Policy>(std::piecewise_construct, std::move(left_args),
+                                                      std::move(right_args)), priority(priority) {}
+
+        // Key of the tree of Tag
+        template<typename Tag>
+        decltype(auto) get() const noexcept {
+            if constexpr (std::is_same_v<Tag, tag_left>) {
+                return this->get_left();
+            } else {
+                return this->get_right();
+            }
+        }
 
-        template<typename Key1, typename Value1, typename Tag1>
+        template<typename Key1, typename Value1, typename Tag1, typename Policy1>
         friend
         struct map_iterator;
 
-        template<typename Key1, typename Value1, typename Compare1, typename tag_t1>
+        template<typename Key1, typename Value1, typename Compare1, typename tag_t1, typename Policy1>
         friend
         struct map;
 
-        template<typename Left1, typename Right1, typename CompareLeft1, typename CompareRight1>
+        template<typename Left1, typename Right1, typename CompareLeft1, typename CompareRight1, typename Allocator1,
+                typename Policy1>
         friend
         struct::bimap;
     private:
-        Left left;
-        Right right;
+        // Treap priority shared by both trees, or a WAVL rank of each tree in a byte (see map::rank_)
         int priority;
     };
 
-    template<typename Key, typename Value, typename tag_t>
+    template<typename Key, typename Value, typename tag_t, typename Policy = default_policy>
     struct map_iterator {
-        using iterator = map_iterator<Key, Value, tag_t>;
+        using iterator = map_iterator<Key, Value, tag_t, Policy>;
 
-        using element_t = std::conditional_t<std::is_same_v<tag_t, tag_left>, map_element<Key, Value>, map_element<Value, Key>>;
+        using element_t = std::conditional_t<std::is_same_v<tag_t, tag_left>, map_element<Key, Value, Policy>, map_element<Value, Key, Policy>>;
 
         using opposite_tag_t = std::conditional_t<std::is_same_v<tag_t, tag_left>, tag_right, tag_left>;
-        using opposite_iterator = map_iterator<Value, Key, opposite_tag_t>;
+        using opposite_iterator = map_iterator<Value, Key, opposite_tag_t, Policy>;
+
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = Key;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Key const *;
+        using reference = Key const &;
 
         map_iterator()
                 : current(nullptr) {}
@@ -130,12 +917,11 @@ namespace intrusive {
         // Dereferencing end_left() is undefined.
         // Dereferencing invalid iterator is undefined.
         Key const &operator*() const {
-            element_t const &el = from_base<element_t, tag_t>(*current);
-            if constexpr (std::is_same_v<tag_t, tag_left>) {
-                return el.left;
-            } else {
-                return el.right;
-            }
+            return from_base<element_t, tag_t>(*current).template get<tag_t>();
+        }
+
+        Key const *operator->() const {
+            return &**this;
         }
 
         // Going to the next left.
@@ -191,10 +977,31 @@ namespace intrusive {
         // end_left().flip() returns end_right().
         // end_right().flip() returns end_left().
         // flip() using for invalid iterator is undefined.
+        // The fake node of the end keeps the opposite fake in its unused right link.
         opposite_iterator flip() const {
+            if (current->parent == nullptr) {
+                return opposite_iterator(current->right);
+            }
             return opposite_iterator(&to_base<element_t, opposite_tag_t>(from_base<element_t, tag_t>(*current)));
         }
 
+        // Position of the element in the sorted order, the number of elements for end().
+        // Works in O(h), requires order statistics.
+        template<typename P = Policy, std::enable_if_t<P::order_statistics, bool> = true>
+        std::size_t index() const noexcept {
+            node_base const *n = current;
+            if (n->parent == nullptr) {
+                return subtree_size<element_t, tag_t>(n->left);
+            }
+            std::size_t res = subtree_size<element_t, tag_t>(n->left);
+            for (; n->parent->parent != nullptr; n = n->parent) {
+                if (n->parent->right == n) {
+                    res += subtree_size<element_t, tag_t>(n->parent->left) + 1;
+                }
+            }
+            return res;
+        }
+
         bool operator==(iterator const &rhs) const & noexcept {
             return current == rhs.current;
         }
@@ -214,98 +1021,443 @@ namespace intrusive {
     private:
         node_base const *current;
 
-        template<typename Key1, typename Value1, typename tag_t1>
+        template<typename Key1, typename Value1, typename tag_t1, typename Policy1>
         friend
         struct map_iterator;
 
-        template<typename Key1, typename Value1, typename Compare1, typename Tag1>
+        template<typename Key1, typename Value1, typename Compare1, typename Tag1, typename Policy1>
         friend
         struct map;
 
-        template<typename Left, typename Right, typename CompareLeft, typename CompareRight>
+        template<typename Left, typename Right, typename CompareLeft, typename CompareRight, typename Allocator,
+                typename Policy1>
         friend
         struct::bimap;
     };
 
-    template<typename Key, typename Value, typename Compare, typename Tag>
-    struct map : private Compare {
-        using element_t = std::conditional_t<std::is_same_v<tag_left, Tag>, map_element<Key, Value>, map_element<Value, Key>>;
-        using iterator = map_iterator<Key, Value, Tag>;
+    // Logarithmic distance for iterators with order statistics, it is found by ADL:
+    // using std::distance; distance(first, last);
+    template<typename Key, typename Value, typename Tag, typename Policy, std::enable_if_t<Policy::order_statistics, bool> = true>
+    std::ptrdiff_t distance(map_iterator<Key, Value, Tag, Policy> first, map_iterator<Key, Value, Tag, Policy> last) noexcept {
+        return static_cast<std::ptrdiff_t>(last.index()) - static_cast<std::ptrdiff_t>(first.index());
+    }
+
+    // Half-open range of a tree for range-for, it only keeps two iterators.
+    template<typename Iterator>
+    struct map_range {
+        map_range(Iterator first, Iterator last) noexcept
+                : first(first), last(last) {}
+
+        Iterator begin() const noexcept {
+            return first;
+        }
+
+        Iterator end() const noexcept {
+            return last;
+        }
+
+        bool empty() const noexcept {
+            return first == last;
+        }
+
+    private:
+        Iterator first;
+        Iterator last;
+    };
+
+    template<typename Key, typename Value, typename Compare, typename Tag, typename Policy = default_policy>
+    struct map : private Compare, private map_counters<Policy::statistics> {
+        using element_t = std::conditional_t<std::is_same_v<tag_left, Tag>, map_element<Key, Value, Policy>, map_element<Value, Key, Policy>>;
+        using iterator = map_iterator<Key, Value, Tag, Policy>;
+
+        static constexpr bool treap = std::is_same_v<typename Policy::balancing, treap_balancing>;
 
         map(Compare cmp = Compare()) noexcept
                 : Compare(std::move(cmp)), fake{nullptr, nullptr, nullptr} {}
 
+        // Only trees are moved, fake.right belongs to the owner (see map_iterator::flip).
         map(map &&other) noexcept
-                : Compare(std::move(other)), fake(other.fake) {
-            other.fake.clear();
+                : Compare(std::move(other)), fake{other.fake.left, nullptr, nullptr},
+                  rightmost(other.fake.left != nullptr ? other.rightmost : &fake) {
+            other.forget_nodes_();
             upd_parent(fake.left, &fake);
         }
 
         map &operator=(map &&other) noexcept {
             if (this != &other) {
                 static_cast<Compare &>(*this) = std::move(static_cast<Compare &>(other));
-                fake = other.fake;
-                other.fake.clear();
+                fake.left = other.fake.left;
+                rightmost = other.fake.left != nullptr ? other.rightmost : &fake;
+                other.forget_nodes_();
                 upd_parent(fake.left, &fake);
             }
             return *this;
         }
 
-        iterator insert(node_base *n) {
-            insert_(fake.left, n);
-            upd_parent(fake.left, &fake);
-            return lower_bound(get_key_(n));
+        // Result of the descent for insertion:
+        // either a node with an equivalent key is found or slot is the place to link a new node to.
+        struct insert_position {
+            node_base *found;
+            node_base *parent;
+            node_base **slot;
+        };
+
+        // Single descent with one comparison per level.
+        insert_position find_insert_position(Key const &key) {
+            node_base *parent = &fake;
+            node_base **slot = &fake.left;
+            node_base *candidate = nullptr;
+            std::size_t depth = 0;
+            while (*slot != nullptr) {
+                parent = *slot;
+                ++depth;
+                if (cmp(key, get_key_(parent))) {
+                    slot = &parent->left;
+                } else {
+                    candidate = parent;
+                    slot = &parent->right;
+                }
+            }
+            record_descent_(depth);
+            if (candidate != nullptr && !cmp(get_key_(candidate), key)) {
+                return {candidate, nullptr, nullptr};
+            }
+            return {nullptr, parent, slot};
         }
 
-        iterator erase(Key const &key) {
-            erase_(fake.left, key);
-            upd_parent(fake.left, &fake);
+        // The same by a finger search from hint (see finger_), hint may be end().
+        insert_position find_insert_position(iterator hint, Key const &key) {
+            finger f = finger_(const_cast<node_base *>(hint.get_data()), key);
+            if (f.bound != &fake && !cmp(key, get_key_(f.bound))) {
+                record_descent_(f.depth);
+                return {f.bound, nullptr, nullptr};
+            }
+            node_base *parent = f.start;
+            node_base **slot = f.right ? &parent->right : &parent->left;
+            node_base *candidate = nullptr;
+            std::size_t depth = f.depth;
+            while (*slot != nullptr) {
+                parent = *slot;
+                ++depth;
+                if (cmp(key, get_key_(parent))) {
+                    slot = &parent->left;
+                } else {
+                    candidate = parent;
+                    slot = &parent->right;
+                }
+            }
+            record_descent_(depth);
+            if (candidate != nullptr && !cmp(get_key_(candidate), key)) {
+                return {candidate, nullptr, nullptr};
+            }
+            return {nullptr, parent, slot};
+        }
+
+        // Links n to the found slot and restores the balance: a treap lifts it up by rotations to restore
+        // the heap order, a WAVL tree fixes ranks on the way up.
+        // Invariant: nothing was changed in the tree since pos was found
+        void link(insert_position const &pos, node_base *n) {
+            if (rightmost == &fake || pos.slot == &rightmost->right) {
+                rightmost = n;
+            }
+            n->left = n->right = nullptr;
+            n->parent = pos.parent;
+            *pos.slot = n;
+            update_path_(n, &fake);
+            if constexpr (treap) {
+                while (n->parent != &fake && get_priority_(n->parent) < get_priority_(n)) {
+                    rotate_up_(n);
+                }
+            } else {
+                set_rank_(n, 0);
+                rebalance_after_link_(n);
+            }
+        }
+
+        iterator insert(node_base *n) {
+            if constexpr (treap) {
+                insert_(fake.left, &fake, n);
+            } else {
+                link(find_insert_position(get_key_(n)), n);
+            }
+            return lower_bound(get_key_(n));
+        }
+
+        iterator erase(Key const &key) {
+            if constexpr (treap) {
+                erase_(fake.left, &fake, key);
+            } else {
+                unlink(const_cast<node_base *>(find_(key).current));
+            }
+            return lower_bound(key);
+        }
+
+        // Unlinks n from the tree without searching.
+        // A treap merges its children to its place, a WAVL tree replaces it by the successor if it has two.
+        void unlink(node_base *n) noexcept {
+            unlinking_(n);
+            if constexpr (treap) {
+                node_base *parent = n->parent;
+                merge_(parent->left == n ? parent->left : parent->right, parent, n->left, n->right);
+                update_path_(parent, &fake);
+            } else {
+                unlink_wavl_(n);
+            }
+        }
+
+        // Cuts out nodes from [first, last) without comparisons and returns the root of the tree made of them.
+        // A WAVL tree unlinks them one by one and chains them by right links.
+        node_base *cut(iterator first, iterator last) noexcept {
+            if (first == last) {
+                return nullptr;
+            }
+            if constexpr (!treap) {
+                node_base *res = nullptr;
+                node_base **tail = &res;
+                while (first != last) {
+                    node_base *n = const_cast<node_base *>(first.current);
+                    ++first;
+                    unlink(n);
+                    n->left = n->right = n->parent = nullptr;
+                    *tail = n;
+                    tail = &n->right;
+                }
+                return res;
+            }
+            node_base *before, *after, *res;
+            node_base *root = fake.left;
+            fake.left = nullptr;
+            upd_parent(root, nullptr);
+            split_before_(const_cast<node_base *>(last.current), nullptr, root, before, after);
+            split_before_(const_cast<node_base *>(first.current), nullptr, before, before, res);
+            merge_(fake.left, &fake, before, after);
+            find_rightmost_();
+            return res;
+        }
+
+        // Moves all nodes of other into this tree by treap union, keys of the trees have to be distinct.
+        // Recursion levels above parallel_depth run their left halves in separate threads.
+        // A WAVL tree links nodes of a small other one by one or rebuilds itself from both sorted sequences.
+        void unite(map &other, std::size_t parallel_depth) {
+            if constexpr (!treap) {
+                unite_wavl_(other);
+                return;
+            }
+            node_base *a = fake.left;
+            node_base *b = other.fake.left;
+            other.forget_nodes_();
+            upd_parent(a, nullptr);
+            upd_parent(b, nullptr);
+            fake.left = unite_(a, b, parallel_depth);
+            upd_parent(fake.left, &fake);
+            find_rightmost_();
+        }
+
+        // Recursive implementations of insert and erase, kept to compare with the iterative ones.
+        iterator insert_recursive(node_base *n) {
+            static_assert(treap, "recursive insert is implemented for treaps only");
+            insert_recursive_(fake.left, n);
+            upd_parent(fake.left, &fake);
+            find_rightmost_();
+            return lower_bound(get_key_(n));
+        }
+
+        iterator erase_recursive(Key const &key) {
+            static_assert(treap, "recursive erase is implemented for treaps only");
+            erase_recursive_(fake.left, key);
+            upd_parent(fake.left, &fake);
+            find_rightmost_();
             return lower_bound(key);
         }
 
+        // Links nodes sorted by key into the tree in linear time.
+        // The right spine of the tree built so far is used as a stack (fake has the biggest priority),
+        // a WAVL tree is built of halves with ranks equal to heights.
+        // Invariant: map is empty, keys are unique
+        template<typename It>
+        void build_sorted(It first, It last) {
+            if constexpr (!treap) {
+                std::vector<node_base *> nodes(first, last);
+                fake.left = build_balanced_(nodes.data(), nodes.size(), &fake);
+                find_rightmost_();
+                return;
+            }
+            node_base *top = &fake;
+            for (; first != last; ++first) {
+                node_base *n = *first;
+                node_base *popped = nullptr;
+                while (top != &fake && get_priority_(top) < get_priority_(n)) {
+                    popped = top;
+                    top = top->parent;
+                    update_(popped);
+                }
+                n->left = popped;
+                n->right = nullptr;
+                n->parent = top;
+                upd_parent(popped, n);
+                (top == &fake ? top->left : top->right) = n;
+                top = n;
+            }
+            update_path_(top, &fake);
+            rightmost = top;
+        }
+
+        // Copies the shape of other's tree, clone(n) has to return a copy of the element of n.
+        // Invariant: map is empty
+        template<typename Clone>
+        void clone_from(map const &other, Clone &&clone) {
+            fake.left = clone_(other.fake.left, &fake, clone);
+            find_rightmost_();
+        }
+
+        // Writes find(key) for every key of [first, last) to out.
+        // Descents of a group of keys are interleaved: each round moves every unfinished descent one level down
+        // and prefetches the nodes of the next level, so cache misses of different keys overlap.
+        template<typename ForwardIt, typename OutputIt>
+        OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+            ForwardIt keys[batch_group];
+            node_base const *current[batch_group];
+            node_base const *res[batch_group];
+            std::size_t active[batch_group];
+            while (first != last) {
+                std::size_t n = 0;
+                for (; n < batch_group && first != last; ++n, ++first) {
+                    keys[n] = first;
+                    current[n] = fake.left;
+                    res[n] = &fake;
+                    active[n] = n;
+                }
+                for (std::size_t remaining = n; remaining > 0;) {
+                    std::size_t kept = 0;
+                    for (std::size_t j = 0; j < remaining; ++j) {
+                        std::size_t i = active[j];
+                        node_base const *c = current[i];
+                        if (c == nullptr) {
+                            continue;
+                        }
+                        if (!cmp(get_key_(c), *keys[i])) {
+                            res[i] = c;
+                            c = c->left;
+                        } else {
+                            c = c->right;
+                        }
+                        if (c != nullptr) {
+                            prefetch(c);
+                            prefetch(&get_key_(c));
+                            active[kept++] = i;
+                        }
+                        current[i] = c;
+                    }
+                    remaining = kept;
+                }
+                for (std::size_t i = 0; i < n; ++i) {
+                    *out = (res[i] != &fake && !cmp(*keys[i], get_key_(res[i]))) ? iterator(res[i]) : end();
+                    ++out;
+                }
+            }
+            return out;
+        }
+
+        // Lookups also accept any K comparable with Key if Compare::is_transparent is defined.
         iterator find(Key const &key) const {
-            iterator res = lower_bound(key);
-            return (res != end() && equals(key, *res)) ? res : end();
+            return find_(key);
+        }
+
+        template<typename K, typename C = Compare, typename = typename C::is_transparent>
+        iterator find(K const &key) const {
+            return find_(key);
         }
 
         Value const &at(Key const &key) const {
-            iterator it = find(key);
-            if (it != end()) {
-                return *it.flip();
-            } else {
-                throw std::out_of_range("No map_element with such key");
-            }
+            return at_(key);
         }
 
-        iterator lower_bound(Key const &key) const {
+        template<typename K, typename C = Compare, typename = typename C::is_transparent>
+        Value const &at(K const &key) const {
+            return at_(key);
+        }
+
+        // Order statistics, require Policy::order_statistics.
+        // Returns iterator to the k-th (from zero) key or end() if there are not enough keys.
+        iterator nth(std::size_t k) const {
             node_base const *current = fake.left;
-            node_base const *res = &fake;
             while (current != nullptr) {
-                Key const &k = get_key_(current);
-                if (cmp(key, k) || equals(key, k)) {
-                    res = current;
+                std::size_t left_size = subtree_size<element_t, Tag>(current->left);
+                if (k < left_size) {
                     current = current->left;
+                } else if (k == left_size) {
+                    return iterator(current);
                 } else {
+                    k -= left_size + 1;
                     current = current->right;
                 }
             }
-            return iterator(res);
+            return end();
         }
 
-        iterator upper_bound(Key const &key) const {
+        // Returns the number of keys less than key.
+        std::size_t rank(Key const &key) const {
             node_base const *current = fake.left;
-            node_base const *res = &fake;
+            std::size_t res = 0;
             while (current != nullptr) {
-                if (cmp(key, get_key_(current))) {
+                if (cmp(get_key_(current), key)) {
+                    res += subtree_size<element_t, Tag>(current->left) + 1;
+                    current = current->right;
+                } else {
+                    current = current->left;
+                }
+            }
+            return res;
+        }
+
+        // Keys of [from, to), the range is empty unless from < to.
+        map_range<iterator> range(Key const &from, Key const &to) const {
+            iterator first = lower_bound_(from);
+            return {first, cmp(from, to) ? lower_bound_(to) : first};
+        }
+
+        // Number of keys of [from, to) by two ranks, requires Policy::order_statistics.
+        std::size_t count_range(Key const &from, Key const &to) const {
+            return cmp(from, to) ? rank(to) - rank(from) : 0;
+        }
+
+        iterator lower_bound(Key const &key) const {
+            return lower_bound_(key);
+        }
+
+        template<typename K, typename C = Compare, typename = typename C::is_transparent>
+        iterator lower_bound(K const &key) const {
+            return lower_bound_(key);
+        }
+
+        // Finger search from hint, which may be any iterator including end().
+        iterator lower_bound(iterator hint, Key const &key) const {
+            finger f = const_cast<map *>(this)->finger_(const_cast<node_base *>(hint.get_data()), key);
+            node_base const *current = f.right ? f.start->right : f.start->left;
+            node_base const *res = f.bound;
+            std::size_t depth = f.depth;
+            while (current != nullptr) {
+                ++depth;
+                if (!cmp(get_key_(current), key)) {
                     res = current;
                     current = current->left;
                 } else {
                     current = current->right;
                 }
             }
+            record_descent_(depth);
             return iterator(res);
         }
 
+        iterator upper_bound(Key const &key) const {
+            return upper_bound_(key);
+        }
+
+        template<typename K, typename C = Compare, typename = typename C::is_transparent>
+        iterator upper_bound(K const &key) const {
+            return upper_bound_(key);
+        }
+
         iterator begin() const {
             node_base const *current = fake.left;
             if (current == nullptr) {
@@ -325,104 +1477,666 @@ namespace intrusive {
             return !cmp(key1, key2) && !cmp(key2, key1);
         }
 
+        // Snapshot of the counters, requires Policy::statistics.
+        // max_depth is found by a walk over the tree.
+        side_statistics statistics() const {
+            side_statistics res;
+            auto get = [this](operation_kind kind) {
+                operation_counters const &c = this->operations[kind];
+                return operation_statistics{c.count.get(), c.comparisons.get(), c.max_comparisons.get()};
+            };
+            res.lookups = get(lookup_operation);
+            res.insertions = get(insert_operation);
+            res.erasures = get(erase_operation);
+            res.comparisons = this->comparisons.get();
+            for (stat_counter const &c : this->depths) {
+                res.depth_histogram.push_back(c.get());
+            }
+            res.max_depth = height();
+            return res;
+        }
+
+        void reset_statistics() noexcept {
+            this->comparisons.reset();
+            for (stat_counter &c : this->depths) {
+                c.reset();
+            }
+            for (operation_counters &c : this->operations) {
+                c.count.reset();
+                c.comparisons.reset();
+                c.max_comparisons.reset();
+            }
+            this->allocations.reset();
+            this->frees.reset();
+        }
+
+        // The number of nodes on the longest path from the root.
+        std::size_t height() const {
+            std::size_t res = 0;
+            std::vector<std::pair<node_base const *, std::size_t>> stack;
+            if (fake.left != nullptr) {
+                stack.emplace_back(fake.left, 1);
+            }
+            while (!stack.empty()) {
+                auto [n, depth] = stack.back();
+                stack.pop_back();
+                res = std::max(res, depth);
+                if (n->left != nullptr) {
+                    stack.emplace_back(n->left, depth + 1);
+                }
+                if (n->right != nullptr) {
+                    stack.emplace_back(n->right, depth + 1);
+                }
+            }
+            return res;
+        }
+
         void swap(map &other) noexcept {
             using std::swap;
             upd_parent(fake.left, &other.fake);
             upd_parent(other.fake.left, &fake);
-            swap(fake, other.fake);
+            swap(fake.left, other.fake.left);
+            node_base *mine = fake.left != nullptr ? other.rightmost : &fake;
+            other.rightmost = other.fake.left != nullptr ? rightmost : &other.fake;
+            rightmost = mine;
             swap(static_cast<Compare &>(*this), static_cast<Compare &>(other));
         }
 
     private:
+        // Number of interleaved descents in find_batch, about the number of cache misses a core keeps in flight
+        static constexpr std::size_t batch_group = 16;
+
         Compare const &get_cmp() const {
             return static_cast<Compare const &>(*this);
         }
 
-        bool cmp(Key const &key1, Key const &key2) const {
+        template<typename K1, typename K2>
+        bool cmp(K1 const &key1, K2 const &key2) const {
+            if constexpr (Policy::statistics) {
+                this->comparisons.add();
+                ++thread_comparisons();
+            }
             return get_cmp()(key1, key2);
         }
 
-        Key const &get_key_(node_base const *const &n) const {
-            element_t const &el = from_base<element_t, Tag>(*n);
-            if constexpr (std::is_same_v<Tag, tag_left>) {
-                return el.left;
+        // Accounts a descent which visited depth nodes.
+        void record_descent_(std::size_t depth) const noexcept {
+            if constexpr (Policy::statistics) {
+                this->depths[std::min(depth, map_counters<true>::depth_buckets - 1)].add();
+            }
+        }
+
+        template<typename K>
+        iterator find_(K const &key) const {
+            iterator res = lower_bound_(key);
+            return (res != end() && !cmp(key, *res)) ? res : end();
+        }
+
+        template<typename K>
+        Value const &at_(K const &key) const {
+            iterator it = find_(key);
+            if (it != end()) {
+                return *it.flip();
             } else {
-                return el.right;
+                throw std::out_of_range("No map_element with such key");
             }
         }
 
+        // Place to descend from: lower bound of the key is in the subtree of the right (or left) child of start,
+        // or it is bound if there is no such key in that subtree.
+        struct finger {
+            node_base *start;
+            bool right;
+            node_base *bound;
+            std::size_t depth;
+        };
+
+        // Climbs from the hint while the key may be out of the current subtree. Only ancestors on the key's side
+        // are compared: `below` is the greatest node known to be less than the key, `above` is the least one
+        // known to be not less. A key d positions away from the hint costs expected O(log d) comparisons.
+        // A key greater than the maximum goes right under rightmost without climbing, so a run of sorted keys
+        // hinted by the previous insertion or by end() takes O(1) per key plus the rebalancing, which is amortized
+        // O(1) as well. end() as a hint for any other key gives the usual descent from the root.
+        finger finger_(node_base *hint, Key const &key) {
+            if (hint == &fake) {
+                if (rightmost != &fake && cmp(get_key_(rightmost), key)) {
+                    return {rightmost, true, &fake, 1};
+                }
+                return {&fake, false, &fake, 0};
+            }
+            std::size_t depth = 1;
+            if (cmp(get_key_(hint), key)) {
+                if (hint == rightmost) {
+                    return {hint, true, &fake, depth};
+                }
+                node_base *below = hint;
+                for (node_base *x = hint; x->parent != &fake; x = x->parent) {
+                    node_base *p = x->parent;
+                    if (p->left == x) {
+                        ++depth;
+                        if (!cmp(get_key_(p), key)) {
+                            return {below, true, p, depth};
+                        }
+                        below = p;
+                    }
+                }
+                return {below, true, &fake, depth};
+            } else {
+                node_base *above = hint;
+                for (node_base *x = hint; x->parent != &fake; x = x->parent) {
+                    node_base *p = x->parent;
+                    if (p->right == x) {
+                        ++depth;
+                        if (cmp(get_key_(p), key)) {
+                            break;
+                        }
+                        above = p;
+                    }
+                }
+                return {above, false, above, depth};
+            }
+        }
+
+        template<typename K>
+        iterator lower_bound_(K const &key) const {
+            node_base const *current = fake.left;
+            node_base const *res = &fake;
+            std::size_t depth = 0;
+            while (current != nullptr) {
+                ++depth;
+                if (!cmp(get_key_(current), key)) {
+                    res = current;
+                    current = current->left;
+                } else {
+                    current = current->right;
+                }
+            }
+            record_descent_(depth);
+            return iterator(res);
+        }
+
+        template<typename K>
+        iterator upper_bound_(K const &key) const {
+            node_base const *current = fake.left;
+            node_base const *res = &fake;
+            std::size_t depth = 0;
+            while (current != nullptr) {
+                ++depth;
+                if (cmp(key, get_key_(current))) {
+                    res = current;
+                    current = current->left;
+                } else {
+                    current = current->right;
+                }
+            }
+            record_descent_(depth);
+            return iterator(res);
+        }
+
+        Key const &get_key_(node_base const *const &n) const {
+            return from_base<element_t, Tag>(*n).template get<Tag>();
+        }
+
         int get_priority_(node_base const *const &n) const {
             return from_base<element_t, Tag>(*n).priority;
         }
 
+        // Nodes with keys not greater than key go to left, others to right.
+        // Parents of the roots are null.
         void split_(node_base *t, Key const &key, node_base *&left, node_base *&right) {
+            node_base **l = &left;
+            node_base **r = &right;
+            node_base *left_parent = nullptr;
+            node_base *right_parent = nullptr;
+            while (t != nullptr) {
+                if (cmp(key, get_key_(t))) {
+                    *r = t;
+                    t->parent = right_parent;
+                    right_parent = t;
+                    r = &t->left;
+                    t = t->left;
+                } else {
+                    *l = t;
+                    t->parent = left_parent;
+                    left_parent = t;
+                    l = &t->right;
+                    t = t->right;
+                }
+            }
+            *l = *r = nullptr;
+            update_path_(left_parent, nullptr);
+            update_path_(right_parent, nullptr);
+        }
+
+        // Splits the tree t before its node n going up from n by parents, so no comparisons are needed:
+        // left gets nodes preceding n, right gets n and the following ones, top is the parent of t.
+        // If n is not in t (e.g. it is the fake), everything goes to left.
+        // Parents of the roots are null.
+        void split_before_(node_base *n, node_base const *top, node_base *t, node_base *&left, node_base *&right) noexcept {
+            if (n == &fake) {
+                left = t;
+                right = nullptr;
+                return;
+            }
+            node_base *l = n->left;
+            node_base *r = n;
+            n->left = nullptr;
+            update_(n);
+            for (node_base *c = n, *a = n->parent; a != top; c = a, a = a->parent) {
+                if (a->left == c) {
+                    a->left = r;
+                    upd_parent(r, a);
+                    r = a;
+                } else {
+                    a->right = l;
+                    upd_parent(l, a);
+                    l = a;
+                }
+                update_(a);
+            }
+            upd_parent(l, nullptr);
+            upd_parent(r, nullptr);
+            left = l;
+            right = r;
+        }
+
+        // t is a child of parent
+        void merge_(node_base *&t, node_base *parent, node_base *left, node_base *right) {
+            node_base *top = parent;
+            node_base **slot = &t;
+            while (left != nullptr && right != nullptr) {
+                if (get_priority_(right) < get_priority_(left)) {
+                    *slot = left;
+                    left->parent = parent;
+                    parent = left;
+                    slot = &left->right;
+                    left = left->right;
+                } else {
+                    *slot = right;
+                    right->parent = parent;
+                    parent = right;
+                    slot = &right->left;
+                    right = right->left;
+                }
+            }
+            *slot = left != nullptr ? left : right;
+            upd_parent(*slot, parent);
+            update_path_(parent, top);
+        }
+
+        // Invariant: nodes have unique keys
+        void insert_(node_base *&t, node_base *parent, node_base *n) {
+            node_base **slot = &t;
+            bool right_spine = true;
+            while (*slot != nullptr && get_priority_(n) <= get_priority_(*slot)) {
+                parent = *slot;
+                if (cmp(get_key_(n), get_key_(parent))) {
+                    slot = &parent->left;
+                    right_spine = false;
+                } else {
+                    slot = &parent->right;
+                }
+            }
+            split_(*slot, get_key_(n), n->left, n->right);
+            upd_parent(n->left, n);
+            upd_parent(n->right, n);
+            *slot = n;
+            n->parent = parent;
+            update_path_(n, &fake);
+            if (right_spine && n->right == nullptr) {
+                rightmost = n;
+            }
+        }
+
+        // Invariant: key exists
+        void erase_(node_base *&t, node_base *parent, Key const &key) {
+            node_base **slot = &t;
+            std::size_t depth = 1;
+            for (;; ++depth) {
+                Key const &k = get_key_(*slot);
+                if (cmp(key, k)) {
+                    parent = *slot;
+                    slot = &parent->left;
+                } else if (cmp(k, key)) {
+                    parent = *slot;
+                    slot = &parent->right;
+                } else {
+                    break;
+                }
+            }
+            record_descent_(depth);
+            node_base *n = *slot;
+            unlinking_(n);
+            merge_(*slot, parent, n->left, n->right);
+            update_path_(parent, &fake);
+        }
+
+        void split_recursive_(node_base *t, Key const &key, node_base *&left, node_base *&right) {
             if (t == nullptr) {
                 left = right = nullptr;
             } else {
                 if (cmp(key, get_key_(t))) {
-                    split_(t->left, key, left, t->left);
+                    split_recursive_(t->left, key, left, t->left);
                     right = t;
                     upd_parent(right->left, right);
                 } else {
-                    split_(t->right, key, t->right, right);
+                    split_recursive_(t->right, key, t->right, right);
                     left = t;
                     upd_parent(left->right, left);
                 }
+                update_(t);
             }
         }
 
-        void merge_(node_base *&t, node_base *left, node_base *right) {
+        void merge_recursive_(node_base *&t, node_base *left, node_base *right) {
             if (!left || !right) {
                 t = left != nullptr ? left : right;
             } else {
                 if (get_priority_(right) < get_priority_(left)) {
-                    merge_(left->right, left->right, right);
+                    merge_recursive_(left->right, left->right, right);
                     t = left;
                     upd_parent(t->right, t);
                 } else {
-                    merge_(right->left, left, right->left);
+                    merge_recursive_(right->left, left, right->left);
                     t = right;
                     upd_parent(t->left, t);
                 }
+                update_(t);
             }
         }
 
-        // Invariatn: nodes have unique keys
-        void insert_(node_base *&t, node_base *n) {
+        void insert_recursive_(node_base *&t, node_base *n) {
             if (t == nullptr) {
                 t = n;
             } else {
                 n->parent = t->parent;
                 if (get_priority_(n) > get_priority_(t)) {
-                    split_(t, get_key_(n), n->left, n->right);
+                    split_recursive_(t, get_key_(n), n->left, n->right);
                     upd_parent(n->left, n);
                     upd_parent(n->right, n);
                     t = n;
                 } else {
                     if (cmp(get_key_(n), get_key_(t))) {
-                        insert_(t->left, n);
+                        insert_recursive_(t->left, n);
                         upd_parent(t->left, t);
                     } else {
-                        insert_(t->right, n);
+                        insert_recursive_(t->right, n);
                         upd_parent(t->right, t);
                     }
                 }
+                update_(t);
             }
         }
 
-        // Invariant: key exists
-        void erase_(node_base *&t, Key const &key) {
+        void erase_recursive_(node_base *&t, Key const &key) {
             if (equals(key, get_key_(t))) {
-                merge_(t, t->left, t->right);
+                merge_recursive_(t, t->left, t->right);
             } else {
                 if (cmp(key, get_key_(t))) {
-                    erase_(t->left, key);
+                    erase_recursive_(t->left, key);
                     upd_parent(t->left, t);
                 } else {
-                    erase_(t->right, key);
+                    erase_recursive_(t->right, key);
                     upd_parent(t->right, t);
                 }
+                update_(t);
+            }
+        }
+
+        // The root with the bigger priority stays on top, the other tree is split by its key.
+        node_base *unite_(node_base *a, node_base *b, std::size_t parallel_depth) {
+            if (a == nullptr || b == nullptr) {
+                return a != nullptr ? a : b;
+            }
+            if (get_priority_(a) < get_priority_(b)) {
+                std::swap(a, b);
+            }
+            node_base *left, *right;
+            split_(b, get_key_(a), left, right);
+            node_base *a_left = a->left;
+            node_base *a_right = a->right;
+            std::future<node_base *> async_left;
+            if (parallel_depth > 0) {
+                try {
+                    async_left = std::async(std::launch::async, [this, a_left, left, parallel_depth] {
+                        return unite_(a_left, left, parallel_depth - 1);
+                    });
+                } catch (std::system_error const &) {
+                    // No more threads, the rest is done here
+                }
+            }
+            std::size_t depth = parallel_depth > 0 ? parallel_depth - 1 : 0;
+            a->right = unite_(a_right, right, depth);
+            a->left = async_left.valid() ? async_left.get() : unite_(a_left, left, depth);
+            upd_parent(a->left, a);
+            upd_parent(a->right, a);
+            update_(a);
+            return a;
+        }
+
+        // n takes the place of its parent.
+        void rotate_up_(node_base *n) {
+            node_base *p = n->parent;
+            node_base *g = p->parent;
+            if (p->left == n) {
+                p->left = n->right;
+                upd_parent(p->left, p);
+                n->right = p;
+            } else {
+                p->right = n->left;
+                upd_parent(p->right, p);
+                n->left = p;
+            }
+            p->parent = n;
+            n->parent = g;
+            (g->left == p ? g->left : g->right) = n;
+            update_(p);
+            update_(n);
+        }
+
+        // WAVL rank of a node of this tree, the rank of null is -1.
+        // Ranks of both trees share the priority field: each of them takes a byte, heights never need more.
+        static constexpr unsigned rank_shift = std::is_same_v<Tag, tag_left> ? 0 : 8;
+
+        int rank_(node_base const *n) const noexcept {
+            if (n == nullptr) {
+                return -1;
+            }
+            return static_cast<int>((static_cast<unsigned>(from_base<element_t, Tag>(*n).priority) >> rank_shift) & 0xffu);
+        }
+
+        void set_rank_(node_base *n, int rank) noexcept {
+            int &field = from_base<element_t, Tag>(*n).priority;
+            unsigned rest = static_cast<unsigned>(field) & ~(0xffu << rank_shift);
+            field = static_cast<int>(rest | (static_cast<unsigned>(rank) << rank_shift));
+        }
+
+        // Rank differences of children have to be 1 or 2 and leaves have rank 0.
+        // A new leaf x may be a 0-child: promote parents while the sibling is a 1-child, then one or two rotations.
+        void rebalance_after_link_(node_base *x) noexcept {
+            for (node_base *p = x->parent; p != &fake && rank_(p) == rank_(x); p = x->parent) {
+                bool is_left = p->left == x;
+                node_base *sibling = is_left ? p->right : p->left;
+                if (rank_(p) - rank_(sibling) == 1) {
+                    set_rank_(p, rank_(p) + 1);
+                    x = p;
+                    continue;
+                }
+                node_base *inner = is_left ? x->right : x->left;
+                if (rank_(x) - rank_(inner) == 2) {
+                    rotate_up_(x);
+                    set_rank_(p, rank_(p) - 1);
+                } else {
+                    rotate_up_(inner);
+                    rotate_up_(inner);
+                    set_rank_(inner, rank_(inner) + 1);
+                    set_rank_(x, rank_(x) - 1);
+                    set_rank_(p, rank_(p) - 1);
+                }
+                return;
+            }
+        }
+
+        // Exchanges places and ranks of n and its successor s, n has two children.
+        void swap_with_successor_(node_base *n, node_base *s) noexcept {
+            node_base *p = n->parent;
+            node_base *s_parent = s->parent;
+            node_base *s_right = s->right;
+            int n_rank = rank_(n);
+            set_rank_(n, rank_(s));
+            set_rank_(s, n_rank);
+            (p->left == n ? p->left : p->right) = s;
+            s->parent = p;
+            s->left = n->left;
+            s->left->parent = s;
+            if (s_parent == n) {
+                s->right = n;
+                n->parent = s;
+            } else {
+                s->right = n->right;
+                s->right->parent = s;
+                s_parent->left = n;
+                n->parent = s_parent;
+            }
+            n->left = nullptr;
+            n->right = s_right;
+            upd_parent(s_right, n);
+        }
+
+        void unlink_wavl_(node_base *n) noexcept {
+            if (n->left != nullptr && n->right != nullptr) {
+                node_base *s = n->right;
+                while (s->left != nullptr) {
+                    s = s->left;
+                }
+                swap_with_successor_(n, s);
+            }
+            node_base *child = n->left != nullptr ? n->left : n->right;
+            node_base *p = n->parent;
+            (p->left == n ? p->left : p->right) = child;
+            upd_parent(child, p);
+            update_path_(p, &fake);
+            rebalance_after_unlink_(child, p);
+        }
+
+        // x (may be null) took the place of a removed child of p, so p may be a 2,2 leaf or x may be a 3-child.
+        // Demotions go up while the sibling allows them, then one or two rotations finish.
+        void rebalance_after_unlink_(node_base *x, node_base *p) noexcept {
+            if (p != &fake && p->left == nullptr && p->right == nullptr && rank_(p) == 1) {
+                set_rank_(p, 0);
+                x = p;
+                p = p->parent;
+            }
+            while (p != &fake && rank_(p) - rank_(x) == 3) {
+                bool is_left = p->left == x;
+                node_base *y = is_left ? p->right : p->left;
+                if (rank_(p) - rank_(y) == 2) {
+                    set_rank_(p, rank_(p) - 1);
+                    x = p;
+                    p = p->parent;
+                    continue;
+                }
+                if (rank_(y) - rank_(y->left) == 2 && rank_(y) - rank_(y->right) == 2) {
+                    set_rank_(p, rank_(p) - 1);
+                    set_rank_(y, rank_(y) - 1);
+                    x = p;
+                    p = p->parent;
+                    continue;
+                }
+                node_base *outer = is_left ? y->right : y->left;
+                node_base *inner = is_left ? y->left : y->right;
+                if (rank_(y) - rank_(outer) == 1) {
+                    rotate_up_(y);
+                    set_rank_(y, rank_(y) + 1);
+                    set_rank_(p, rank_(p) - (p->left == nullptr && p->right == nullptr ? 2 : 1));
+                } else {
+                    rotate_up_(inner);
+                    rotate_up_(inner);
+                    set_rank_(inner, rank_(inner) + 2);
+                    set_rank_(y, rank_(y) - 1);
+                    set_rank_(p, rank_(p) - 2);
+                }
+                return;
+            }
+        }
+
+        // Links nodes[0, n) into a tree of the minimal height, ranks are heights.
+        node_base *build_balanced_(node_base *const *nodes, std::size_t n, node_base *parent) noexcept {
+            if (n == 0) {
+                return nullptr;
+            }
+            node_base *t = nodes[n / 2];
+            t->parent = parent;
+            t->left = build_balanced_(nodes, n / 2, t);
+            t->right = build_balanced_(nodes + n / 2 + 1, n - n / 2 - 1, t);
+            set_rank_(t, std::max(rank_(t->left), rank_(t->right)) + 1);
+            update_(t);
+            return t;
+        }
+
+        // Small other is linked node by node in O(m log n), otherwise both trees are merged in order
+        // and rebuilt in O(n + m). Keys of the trees have to be distinct.
+        void unite_wavl_(map &other) {
+            std::size_t m = 0;
+            for (iterator it = other.begin(); it != other.end(); ++it) {
+                ++m;
+            }
+            // This tree is counted only until linking one by one is known to be cheaper
+            std::size_t n = 0, log_n = 0;
+            bool small_other = false;
+            for (iterator it = begin(); it != end() && !small_other; ++it) {
+                ++n;
+                if ((std::size_t(1) << log_n) < n) {
+                    ++log_n;
+                }
+                small_other = m * log_n < n;
+            }
+            if (small_other) {
+                // The tree of other is turned into a list by right rotations while it is consumed
+                node_base *t = other.fake.left;
+                other.forget_nodes_();
+                while (t != nullptr) {
+                    if (t->left != nullptr) {
+                        node_base *l = t->left;
+                        t->left = l->right;
+                        l->right = t;
+                        t = l;
+                    } else {
+                        node_base *next = t->right;
+                        link(find_insert_position(get_key_(t)), t);
+                        t = next;
+                    }
+                }
+                return;
+            }
+            std::vector<node_base *> mine, theirs, all;
+            mine.reserve(n);
+            theirs.reserve(m);
+            all.reserve(n + m);
+            for (iterator it = begin(); it != end(); ++it) {
+                mine.push_back(const_cast<node_base *>(it.current));
+            }
+            for (iterator it = other.begin(); it != other.end(); ++it) {
+                theirs.push_back(const_cast<node_base *>(it.current));
+            }
+            std::merge(mine.begin(), mine.end(), theirs.begin(), theirs.end(), std::back_inserter(all),
+                       [this](node_base const *a, node_base const *b) { return cmp(get_key_(a), get_key_(b)); });
+            other.forget_nodes_();
+            fake.left = build_balanced_(all.data(), all.size(), &fake);
+            find_rightmost_();
+        }
+
+        template<typename Clone>
+        node_base *clone_(node_base const *t, node_base *parent, Clone &clone) {
+            if (t == nullptr) {
+                return nullptr;
             }
+            node_base *res = clone(t);
+            res->parent = parent;
+            res->left = clone_(t->left, res, clone);
+            res->right = clone_(t->right, res, clone);
+            update_(res);
+            return res;
         }
 
         void upd_parent(node_base *t, node_base *p) {
@@ -431,52 +2145,340 @@ namespace intrusive {
             }
         }
 
+        // Recomputes the subtree size of n from its children.
+        void update_(node_base *n) noexcept {
+            if constexpr (Policy::order_statistics) {
+                static_cast<size_hook<Tag, true> &>(from_base<element_t, Tag>(*n)).subtree_size =
+                        1 + subtree_size<element_t, Tag>(n->left) + subtree_size<element_t, Tag>(n->right);
+            }
+        }
+
+        // Keeps rightmost valid when n is about to be unlinked: the predecessor of the maximum is the maximum
+        // of its left subtree or its parent (fake if it was the only node).
+        void unlinking_(node_base *n) noexcept {
+            if (n == rightmost) {
+                rightmost = n->left != nullptr ? rightmost_of_(n->left) : n->parent;
+            }
+        }
+
+        // After changes of the tree which are not followed node by node.
+        void find_rightmost_() noexcept {
+            rightmost = fake.left != nullptr ? rightmost_of_(fake.left) : &fake;
+        }
+
+        static node_base *rightmost_of_(node_base *t) noexcept {
+            while (t->right != nullptr) {
+                t = t->right;
+            }
+            return t;
+        }
+
+        // The nodes are owned by someone else now.
+        void forget_nodes_() noexcept {
+            fake.left = nullptr;
+            rightmost = &fake;
+        }
+
+        // Recomputes subtree sizes on the way from n up to stop (excluding).
+        void update_path_(node_base *n, node_base const *stop) noexcept {
+            if constexpr (Policy::order_statistics) {
+                for (; n != stop; n = n->parent) {
+                    update_(n);
+                }
+            }
+        }
+
     private:
         node_base fake;
+        // The node with the greatest key or fake if the tree is empty, so an append is found in O(1)
+        node_base *rightmost = &fake;
 
-        template<typename Left, typename Right, typename CompareLeft, typename CompareRight>
+        template<typename Left, typename Right, typename CompareLeft, typename CompareRight, typename Allocator,
+                typename Policy1>
         friend
         struct::bimap;
 
-        template<typename Left, typename Right, typename CompareLeft, typename CompareRight>
-        friend bool operator==(::bimap<Left, Right, CompareLeft, CompareRight> const &a,
-                               ::bimap<Left, Right, CompareLeft, CompareRight> const &b);
+        template<typename Left, typename Right, typename CompareLeft, typename CompareRight, typename Allocator,
+                typename Policy1>
+        friend bool operator==(::bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy1> const &a,
+                               ::bimap<Left, Right, CompareLeft, CompareRight, Allocator, Policy1> const &b);
 
-        template<typename Key1, typename Value1, typename Compare1, typename tag_t1>
+        template<typename Key1, typename Value1, typename Compare1, typename tag_t1, typename Policy1>
         friend
         struct map;
     };
 }
 
-template<typename Left, typename Right, typename CompareLeft, typename CompareRight>
-struct bimap {
+namespace intrusive {
+    // Owner of a pair extracted from a bimap (see bimap::extract_left), an empty handle owns nothing.
+    // The node is destroyed by the allocator it was extracted with unless it is inserted back somewhere.
+    template<typename Node, typename Allocator>
+    struct node_handle {
+        using allocator_type = Allocator;
+        using allocator_traits = std::allocator_traits<Allocator>;
+
+        node_handle() noexcept = default;
+
+        node_handle(node_handle &&other) noexcept : nd(other.nd), alloc(std::move(other.alloc)) {
+            other.nd = nullptr;
+            other.alloc.reset();
+        }
+
+        node_handle &operator=(node_handle &&other) noexcept {
+            if (this != &other) {
+                reset_();
+                nd = other.nd;
+                alloc = std::move(other.alloc);
+                other.nd = nullptr;
+                other.alloc.reset();
+            }
+            return *this;
+        }
+
+        ~node_handle() {
+            reset_();
+        }
+
+        bool empty() const noexcept {
+            return nd == nullptr;
+        }
+
+        explicit operator bool() const noexcept {
+            return !empty();
+        }
+
+        // Keys of the pair, the handle must not be empty.
+        decltype(auto) left() const noexcept {
+            return nd->get_left();
+        }
+
+        decltype(auto) right() const noexcept {
+            return nd->get_right();
+        }
+
+        allocator_type get_allocator() const {
+            return *alloc;
+        }
+
+        void swap(node_handle &other) noexcept {
+            std::swap(nd, other.nd);
+            std::swap(alloc, other.alloc);
+        }
+
+    private:
+        node_handle(Node *nd, Allocator const &alloc) : nd(nd), alloc(alloc) {}
+
+        // Gives the node away, the handle becomes empty.
+        Node *release_() noexcept {
+            Node *res = nd;
+            nd = nullptr;
+            alloc.reset();
+            return res;
+        }
+
+        void reset_() noexcept {
+            if (nd != nullptr) {
+                allocator_traits::destroy(*alloc, nd);
+                allocator_traits::deallocate(*alloc, nd, 1);
+                nd = nullptr;
+            }
+            alloc.reset();
+        }
+
+    private:
+        Node *nd = nullptr;
+        std::optional<Allocator> alloc;
+
+        template<typename Left, typename Right, typename CompareLeft, typename CompareRight, typename Allocator1,
+                typename Policy>
+        friend
+        struct ::bimap;
+    };
+}
+
+template<typename Left, typename Right, typename CompareLeft, typename CompareRight, typename Allocator, typename Policy>
+struct bimap : private intrusive::pair_fingerprint<Policy::fingerprint> {
     using tag_left = intrusive::tag_left;
     using tag_right = intrusive::tag_right;
-    using node_t = intrusive::map_element<Left, Right>;
+    using node_t = intrusive::map_element<Left, Right, Policy>;
     using node_base = intrusive::node_base;
+    using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<node_t>;
+    using allocator_traits = std::allocator_traits<allocator_type>;
+
+    using left_iterator = intrusive::map_iterator<Left, Right, tag_left, Policy>;
+    using right_iterator = intrusive::map_iterator<Right, Left, tag_right, Policy>;
+    using node_type = intrusive::node_handle<node_t, allocator_type>;
+
+    // Result of inserting a node handle, node is the handle itself if there was no insertion.
+    struct insert_return_type {
+        left_iterator position;
+        bool inserted;
+        node_type node;
+    };
 
-    using left_iterator = intrusive::map_iterator<Left, Right, tag_left>;
-    using right_iterator = intrusive::map_iterator<Right, Left, tag_right>;
-
-    // Creates empty bimap
+    // Creates empty bimap, the default allocator gets its memory by the first insertion
     bimap(CompareLeft compare_left = CompareLeft(), CompareRight compare_right = CompareRight()) noexcept
-            : bimap(std::move(compare_left), std::move(compare_right), 0) {}
+            : bimap(std::move(compare_left), std::move(compare_right), intrusive::unallocated<allocator_type>(), 0) {}
+
+    bimap(CompareLeft compare_left, CompareRight compare_right, Allocator const &alloc)
+            : bimap(std::move(compare_left), std::move(compare_right), allocator_type(alloc), 0) {}
+
+    // Creates bimap from range of pairs, the result is the same as after inserting them one by one.
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    bimap(InputIt first, InputIt last, CompareLeft compare_left = CompareLeft(),
+          CompareRight compare_right = CompareRight(), Allocator const &alloc = Allocator())
+            : bimap(std::move(compare_left), std::move(compare_right), alloc) {
+        build_(first, last, false);
+    }
+
+    // Similar to the range constructor, but pairs have to be sorted by left.
+    // The left tree is built in linear time, the right one needs a single sort.
+    template<typename InputIt>
+    static bimap from_sorted_left(InputIt first, InputIt last, CompareLeft compare_left = CompareLeft(),
+                                  CompareRight compare_right = CompareRight(), Allocator const &alloc = Allocator()) {
+        bimap res(std::move(compare_left), std::move(compare_right), alloc);
+        res.build_(first, last, true);
+        return res;
+    }
+
+    // Writes the binary image of the bimap to out (see intrusive::image_header), errors are reported by its state.
+    // Positions of a pair in both orders are matched by sorting nodes of each order by address, O(n log n).
+    template<typename L = Left, typename R = Right,
+            std::enable_if_t<std::is_trivially_copyable_v<L> && std::is_trivially_copyable_v<R>, bool> = true>
+    void save(std::ostream &out) const {
+        if (sz > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("bimap is too big to be saved");
+        }
+        // Keys are written during the walks which collect nodes, each walk is a cache miss per node
+        intrusive::image_layout layout(sz, sizeof(Left), sizeof(Right));
+        intrusive::image_header header = intrusive::image_header::make(sizeof(Left), sizeof(Right), sz);
+        intrusive::image_writer writer(out);
+        writer.write(&header, sizeof(header));
+        std::vector<std::pair<node_t const *, std::uint32_t>> by_left, by_right;
+        by_left.reserve(sz);
+        by_right.reserve(sz);
+        writer.pad_to(layout.lefts);
+        for (left_iterator it = begin_left(); it != end_left(); ++it) {
+            writer.write(std::addressof(*it), sizeof(Left));
+            by_left.emplace_back(&intrusive::from_base<node_t, tag_left>(*it.get_data()), by_left.size());
+        }
+        writer.pad_to(layout.rights);
+        for (right_iterator it = begin_right(); it != end_right(); ++it) {
+            writer.write(std::addressof(*it), sizeof(Right));
+            by_right.emplace_back(&intrusive::from_base<node_t, tag_right>(*it.get_data()), by_right.size());
+        }
+
+        std::sort(by_left.begin(), by_left.end(), std::less<>());
+        std::sort(by_right.begin(), by_right.end(), std::less<>());
+        std::vector<std::uint32_t> left_to_right(sz), right_to_left(sz);
+        for (std::size_t i = 0; i < sz; ++i) {
+            left_to_right[by_left[i].second] = by_right[i].second;
+            right_to_left[by_right[i].second] = by_left[i].second;
+        }
+        writer.pad_to(layout.left_to_right);
+        writer.write(left_to_right.data(), sz * sizeof(std::uint32_t));
+        writer.pad_to(layout.right_to_left);
+        writer.write(right_to_left.data(), sz * sizeof(std::uint32_t));
+        writer.pad_to(layout.total);
+        writer.flush();
+    }
+
+    // Reads an image written by save with the same comparators. Both sorted orders are stored,
+    // so the trees are linked in linear time without comparing keys.
+    // Throws std::runtime_error if the image is truncated, was written for other key types or its permutations
+    // are broken, the order of keys is trusted.
+    template<typename L = Left, typename R = Right,
+            std::enable_if_t<std::is_trivially_copyable_v<L> && std::is_trivially_copyable_v<R>, bool> = true>
+    static bimap load(std::istream &in, CompareLeft compare_left = CompareLeft(),
+                      CompareRight compare_right = CompareRight(), Allocator const &alloc = Allocator()) {
+        static_assert(alignof(Left) <= alignof(std::max_align_t) && alignof(Right) <= alignof(std::max_align_t),
+                      "over-aligned keys are not supported");
+        intrusive::image_header header;
+        read_image_(in, &header, sizeof(header));
+        if (!header.valid(sizeof(Left), sizeof(Right))) {
+            throw std::runtime_error("bimap image is malformed");
+        }
+        std::size_t n = header.count;
+        intrusive::image_layout layout(n, sizeof(Left), sizeof(Right));
+        // The count is not trusted before the data is there: a seekable stream is measured first,
+        // otherwise the buffer grows geometrically while it is read, so a forged count cannot allocate
+        // much more than the stream holds.
+        std::streamoff available = remaining_bytes_(in);
+        if (available >= 0 && static_cast<std::uint64_t>(available) < layout.total - sizeof(header)) {
+            throw std::runtime_error("bimap image is truncated");
+        }
+        std::vector<std::max_align_t> buffer;
+        for (std::size_t done = sizeof(header); done < layout.total;) {
+            std::size_t target = available >= 0 ? layout.total
+                                                : std::min(layout.total, std::max(2 * done, image_read_chunk));
+            buffer.resize((target + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+            read_image_(in, reinterpret_cast<char *>(buffer.data()) + done, target - done);
+            done = target;
+        }
+        char *base = reinterpret_cast<char *>(buffer.data());
+
+        bimap res(std::move(compare_left), std::move(compare_right), alloc);
+        res.build_image_(reinterpret_cast<Left const *>(base + layout.lefts),
+                         reinterpret_cast<Right const *>(base + layout.rights),
+                         reinterpret_cast<std::uint32_t const *>(base + layout.left_to_right),
+                         reinterpret_cast<std::uint32_t const *>(base + layout.right_to_left), n);
+        return res;
+    }
 
+    // Copies shapes of both trees, so it works in linear time.
+    // Nodes of the right tree find their copies in a flat table of (original, copy) by linear probing.
     bimap(bimap const &other)
-            : bimap(other.map_left.get_cmp(), other.map_right.get_cmp()) {
+            : bimap(CompareLeft(other.map_left.get_cmp()), CompareRight(other.map_right.get_cmp()),
+                    allocator_traits::select_on_container_copy_construction(other.alloc), 0) {
+        std::size_t capacity = 1;
+        while (capacity < 2 * other.sz) {
+            capacity <<= 1;
+        }
+        std::vector<std::pair<node_t const *, node_t *>> copies(capacity);
+        auto slot_of = [&copies, mask = capacity - 1](node_t const *el) {
+            std::size_t i = intrusive::mix_hash(reinterpret_cast<std::uintptr_t>(el)) & mask;
+            while (copies[i].first != nullptr && copies[i].first != el) {
+                i = (i + 1) & mask;
+            }
+            return i;
+        };
+        try {
+            map_left.clone_from(other.map_left, [&](node_base const *n) {
+                node_t const &el = intrusive::from_base<node_t, tag_left>(*n);
+                node_t *nd = new_node_(el.get_left(), el.get_right(), el.priority);
+                copies[slot_of(&el)] = {&el, nd};
+                return &intrusive::to_base<node_t, tag_left>(*nd);
+            });
+            map_right.clone_from(other.map_right, [&](node_base const *n) {
+                node_t *nd = copies[slot_of(&intrusive::from_base<node_t, tag_right>(*n))].second;
+                return &intrusive::to_base<node_t, tag_right>(*nd);
+            });
+        } catch (...) {
+            for (auto const &p : copies) {
+                if (p.second != nullptr) {
+                    delete_node_(p.second);
+                }
+            }
+            map_left.forget_nodes_();
+            map_right.forget_nodes_();
+            throw;
+        }
         sz = other.sz;
-        left_iterator it = other.map_left.begin();
-        while (it != other.end_left()) {
-            node_t *nd = new node_t(*it, *it.flip(), other.map_left.get_priority_(it.get_data()));
-            map_left.insert(&intrusive::to_base<node_t, tag_left>(*nd));
-            map_right.insert(&intrusive::to_base<node_t, tag_right>(*nd));
-            ++it;
+        if constexpr (Policy::fingerprint) {
+            this->fingerprint_value = other.fingerprint_value;
         }
     }
 
+    // The allocator is moved, a moved-from slab_allocator gets a pool of its own by the next insertion,
+    // so the bimaps do not share a pool.
     bimap(bimap &&other) noexcept
-            : map_left(std::move(other.map_left)), map_right(std::move(other.map_right)), sz(other.sz) {
+            : map_left(std::move(other.map_left)), map_right(std::move(other.map_right)), alloc(std::move(other.alloc)),
+              sz(other.sz) {
+        link_ends_();
         other.sz = 0;
+        if constexpr (Policy::fingerprint) {
+            this->fingerprint_value = std::exchange(other.fingerprint_value, 0);
+        }
     }
 
     bimap &operator=(bimap const &other) {
@@ -496,35 +2498,113 @@ struct bimap {
     }
 
     // Invalidating all iterators.
+    // Nodes are destroyed without rebalancing, the allocator is asked to free all its memory at once if it can.
     ~bimap() {
-        for (left_iterator it = begin_left(); it != end_left();) {
-            erase_left(it++);
+        destroy_nodes_();
+    }
+
+    // Removes all pairs in linear time without any rebalancing, the same way as the destructor does.
+    void clear() noexcept {
+        destroy_nodes_();
+        map_left.forget_nodes_();
+        map_right.forget_nodes_();
+        sz = 0;
+        if constexpr (Policy::fingerprint) {
+            this->fingerprint_value = 0;
         }
     }
 
     // Inserting pair (left, right) returns left iterator.
     // If left or right is already in bimap, there is no insertion and returns end_left().
+    // Each side is descended once, the new node is linked to the found places.
     template<typename L = Left, typename R = Right>
     left_iterator insert(L &&left, R &&right) {
-        if (find_left(left) == end_left() && find_right(right) == end_right()) {
-            node_t *nd = new node_t(std::forward<L>(left), std::forward<R>(right), intrusive::gen());
-            left_iterator it = map_left.insert(&intrusive::to_base<node_t, tag_left>(*nd));
-            map_right.insert(&intrusive::to_base<node_t, tag_right>(*nd));
-            ++sz;
-            return it;
-        } else {
+        auto scope = operation_<tag_left>(intrusive::insert_operation);
+        auto left_pos = map_left.find_insert_position(left);
+        if (left_pos.found != nullptr) {
+            return end_left();
+        }
+        auto right_pos = map_right.find_insert_position(right);
+        if (right_pos.found != nullptr) {
+            return end_left();
+        }
+        node_t *nd = new_node_(std::forward<L>(left), std::forward<R>(right), intrusive::next_priority());
+        return link_(left_pos, right_pos, nd);
+    }
+
+    // Constructs both keys in place, inside the new node, and then looks them up, so each key is built once.
+    // Returns end_left() if left or right is already in bimap, the node goes back to the allocator then.
+    template<typename... LeftArgs, typename... RightArgs>
+    left_iterator emplace(std::piecewise_construct_t, std::tuple<LeftArgs...> left_args,
+                          std::tuple<RightArgs...> right_args) {
+        auto scope = operation_<tag_left>(intrusive::insert_operation);
+        node_t *nd = new_node_(std::piecewise_construct, std::move(left_args), std::move(right_args),
+                               intrusive::next_priority());
+        auto left_pos = map_left.find_insert_position(nd->get_left());
+        if (left_pos.found == nullptr) {
+            auto right_pos = map_right.find_insert_position(nd->get_right());
+            if (right_pos.found == nullptr) {
+                return link_(left_pos, right_pos, nd);
+            }
+        }
+        delete_node_(nd);
+        return end_left();
+    }
+
+    // Nothing is constructed if left is already in bimap, otherwise it is moved into a node with right
+    // constructed from args. Returns end_left() if there was no insertion.
+    template<typename... Args>
+    left_iterator try_emplace_left(Left const &left, Args &&... right_args) {
+        return try_emplace_left_(left, std::forward<Args>(right_args)...);
+    }
+
+    template<typename... Args>
+    left_iterator try_emplace_left(Left &&left, Args &&... right_args) {
+        return try_emplace_left_(std::move(left), std::forward<Args>(right_args)...);
+    }
+
+    // Similar to try_emplace_left, returns end_right() if there was no insertion.
+    template<typename... Args>
+    right_iterator try_emplace_right(Right const &right, Args &&... left_args) {
+        return try_emplace_right_(right, std::forward<Args>(left_args)...);
+    }
+
+    template<typename... Args>
+    right_iterator try_emplace_right(Right &&right, Args &&... left_args) {
+        return try_emplace_right_(std::move(right), std::forward<Args>(left_args)...);
+    }
+
+    // Inserting with a hint: the left place is found by a finger search from hint (see intrusive::map::finger_),
+    // which is cheap if left is close to it. Appending sorted keys hinted by the previous insertion or by
+    // end_left() takes amortized O(1). There is no hint for right, so it is only checked to be an append
+    // the same way, otherwise it is looked up from the root. Returns the same as insert without a hint.
+    template<typename L = Left, typename R = Right>
+    left_iterator insert(left_iterator hint, L &&left, R &&right) {
+        auto scope = operation_<tag_left>(intrusive::insert_operation);
+        auto left_pos = map_left.find_insert_position(hint, left);
+        if (left_pos.found != nullptr) {
+            return end_left();
+        }
+        auto right_pos = map_right.find_insert_position(map_right.end(), right);
+        if (right_pos.found != nullptr) {
             return end_left();
         }
+        node_t *nd = new_node_(std::forward<L>(left), std::forward<R>(right), intrusive::next_priority());
+        return link_(left_pos, right_pos, nd);
     }
 
     // Removes an element and its corresponding paired.
     // erase of invalid iterator is undefined.
     // erase(end_left()) and erase(end_right()) are undefined.
+    // Nodes are unlinked directly, without searching by key.
     left_iterator erase_left(left_iterator it) {
-        map_left.erase(*it);
-        map_right.erase(*it.flip());
-        auto res = map_left.lower_bound(*it);
-        delete &intrusive::from_base<node_t, tag_left>(*it.get_data());
+        auto scope = operation_<tag_left>(intrusive::erase_operation);
+        left_iterator res = std::next(it);
+        node_t *nd = const_cast<node_t *>(&intrusive::from_base<node_t, tag_left>(*it.get_data()));
+        map_left.unlink(&intrusive::to_base<node_t, tag_left>(*nd));
+        map_right.unlink(&intrusive::to_base<node_t, tag_right>(*nd));
+        fingerprint_sub_(nd);
+        delete_node_(nd);
         --sz;
         return res;
     }
@@ -532,6 +2612,7 @@ struct bimap {
     // similar to erase but for key.
     // Returns whether the pair was deleted or not.
     bool erase_left(Left const &left) {
+        auto scope = operation_<tag_left>(intrusive::erase_operation);
         left_iterator it;
         if ((it = find_left(left)) != end_left()) {
             erase_left(it);
@@ -542,15 +2623,19 @@ struct bimap {
     }
 
     right_iterator erase_right(right_iterator it) {
-        map_right.erase(*it);
-        map_left.erase(*it.flip());
-        auto res = map_right.lower_bound(*it);
-        delete &intrusive::from_base<node_t, tag_right>(*it.get_data());
+        auto scope = operation_<tag_right>(intrusive::erase_operation);
+        right_iterator res = std::next(it);
+        node_t *nd = const_cast<node_t *>(&intrusive::from_base<node_t, tag_right>(*it.get_data()));
+        map_right.unlink(&intrusive::to_base<node_t, tag_right>(*nd));
+        map_left.unlink(&intrusive::to_base<node_t, tag_left>(*nd));
+        fingerprint_sub_(nd);
+        delete_node_(nd);
         --sz;
         return res;
     }
 
     bool erase_right(Right const &right) {
+        auto scope = operation_<tag_right>(intrusive::erase_operation);
         right_iterator it;
         if ((it = find_right(right)) != end_right()) {
             erase_right(it);
@@ -560,38 +2645,181 @@ struct bimap {
         }
     }
 
+    // Unlinks the pair from both sides and gives it to the handle, nothing is freed, copied or moved.
+    // Pairs move between bimaps with no allocation if their allocators are equal, for slab_allocator
+    // it means sharing the pool: bimap cold(compare_left, compare_right, hot.get_allocator()).
+    // extract of end_left() or of an invalid iterator is undefined.
+    node_type extract_left(left_iterator it) {
+        auto scope = operation_<tag_left>(intrusive::erase_operation);
+        node_t *nd = const_cast<node_t *>(&intrusive::from_base<node_t, tag_left>(*it.get_data()));
+        return extract_(nd);
+    }
+
+    // Returns an empty handle if there is no such key.
+    node_type extract_left(Left const &left) {
+        left_iterator it = find_left(left);
+        return it == end_left() ? node_type() : extract_left(it);
+    }
+
+    node_type extract_right(right_iterator it) {
+        auto scope = operation_<tag_right>(intrusive::erase_operation);
+        node_t *nd = const_cast<node_t *>(&intrusive::from_base<node_t, tag_right>(*it.get_data()));
+        return extract_(nd);
+    }
+
+    node_type extract_right(Right const &right) {
+        right_iterator it = find_right(right);
+        return it == end_right() ? node_type() : extract_right(it);
+    }
+
+    // Links the node of the handle if neither of its keys is in bimap, otherwise the handle is returned back
+    // together with the position of a conflicting pair.
+    // The node itself is linked if the allocators are equal, else its keys are moved to a new node.
+    // Both keys are copied unless both moves are noexcept, so the handle stays intact on an exception.
+    insert_return_type insert(node_type &&nh) {
+        if (nh.empty()) {
+            return {end_left(), false, node_type()};
+        }
+        auto scope = operation_<tag_left>(intrusive::insert_operation);
+        node_t *nd = nh.nd;
+        auto left_pos = map_left.find_insert_position(nd->get_left());
+        if (left_pos.found != nullptr) {
+            return {left_iterator(left_pos.found), false, std::move(nh)};
+        }
+        auto right_pos = map_right.find_insert_position(nd->get_right());
+        if (right_pos.found != nullptr) {
+            return {right_iterator(right_pos.found).flip(), false, std::move(nh)};
+        }
+        if (*nh.alloc == alloc) {
+            nh.release_();
+        } else {
+            if constexpr (std::is_nothrow_move_constructible_v<Left> &&
+                          std::is_nothrow_move_constructible_v<Right>) {
+                nd = new_node_(std::move(const_cast<Left &>(nd->get_left())),
+                               std::move(const_cast<Right &>(nd->get_right())), intrusive::next_priority());
+            } else {
+                nd = new_node_(nd->get_left(), nd->get_right(), intrusive::next_priority());
+            }
+            nh.reset_();
+        }
+        return {link_(left_pos, right_pos, nd), true, node_type()};
+    }
+
     // erases all elements from range [first, last).
+    // The range is cut out of its tree by two splits, then its nodes are unlinked from the other tree one by one.
     // Returns last
     left_iterator erase_left(left_iterator first, left_iterator last) {
-        for (left_iterator it = first; it != last;) {
-            erase_left(it++);
-        }
+        erase_cut_<tag_left>(map_left.cut(first, last));
         return last;
     }
 
     right_iterator erase_right(right_iterator first, right_iterator last) {
-        for (right_iterator it = first; it != last;) {
-            erase_right(it++);
-        }
+        erase_cut_<tag_right>(map_right.cut(first, last));
         return last;
     }
 
+    // Moves pairs of other into this bimap, other becomes empty.
+    // A pair of other is dropped if its left or right is already here, as if the pairs were inserted one by one.
+    // Both sides are joined by treap union in O(m log(n / m + 1)), for big bimaps it runs on up to threads threads
+    // (comparators are then called concurrently). Nodes are moved if other's memory can be taken over
+    // by this allocator (equal allocators or slab_allocator::absorb), otherwise pairs are copied.
+    void merge(bimap &&other, std::size_t threads = std::thread::hardware_concurrency()) {
+        if (this == &other || other.empty()) {
+            return;
+        }
+        if (!adopt_memory_(other)) {
+            for (left_iterator it = other.begin_left(); it != other.end_left(); ++it) {
+                insert(*it, *it.flip());
+            }
+            bimap dropped(std::move(other));
+            return;
+        }
+        drop_conflicts_<tag_left>(other);
+        drop_conflicts_<tag_right>(other);
+
+        // Sides are united in parallel, each of them gets half of the threads.
+        // WAVL ranks of both sides share the int of a node (see map::rank_), so its sides are united one by one.
+        bool parallel = std::is_same_v<typename Policy::balancing, intrusive::treap_balancing> &&
+                        sz + other.sz >= parallel_merge_size && threads >= 2;
+        std::size_t depth = 0;
+        while (parallel && (std::size_t(4) << depth) <= threads) {
+            ++depth;
+        }
+        if (parallel) {
+            auto left = std::async(std::launch::async, [this, &other, depth] {
+                map_left.unite(other.map_left, depth);
+            });
+            map_right.unite(other.map_right, depth);
+            left.get();
+        } else {
+            map_left.unite(other.map_left, 0);
+            map_right.unite(other.map_right, 0);
+        }
+        sz += other.sz;
+        other.sz = 0;
+        if constexpr (Policy::fingerprint) {
+            this->fingerprint_value += std::exchange(other.fingerprint_value, 0);
+        }
+    }
+
     // Returns element's iterator or end() if the element wasn't found.
+    // Lookups (find, at, lower_bound, upper_bound) also accept keys of other types
+    // if the comparator defines is_transparent, then no temporary Left/Right is created.
     left_iterator find_left(Left const &left) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
+        return map_left.find(left);
+    }
+
+    template<typename L, typename C = CompareLeft, typename = typename C::is_transparent>
+    left_iterator find_left(L const &left) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
         return map_left.find(left);
     }
 
     right_iterator find_right(Right const &right) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
         return map_right.find(right);
     }
 
+    template<typename R, typename C = CompareRight, typename = typename C::is_transparent>
+    right_iterator find_right(R const &right) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
+        return map_right.find(right);
+    }
+
+    // Writes find_left(key) for every key of [first, last) to out and returns the end of the output.
+    // Descents of several keys are interleaved with prefetching, which pays off for bimaps bigger than the cache.
+    template<typename ForwardIt, typename OutputIt>
+    OutputIt find_left_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+        return map_left.find_batch(first, last, out);
+    }
+
+    template<typename ForwardIt, typename OutputIt>
+    OutputIt find_right_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+        return map_right.find_batch(first, last, out);
+    }
+
     // Returns an opposite element by element.
     // If there is no element - throws std::out_of_range.
     Right const &at_left(Left const &key) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
+        return map_left.at(key);
+    }
+
+    template<typename L, typename C = CompareLeft, typename = typename C::is_transparent>
+    Right const &at_left(L const &key) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
         return map_left.at(key);
     }
 
     Left const &at_right(Right const &key) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
+        return map_right.at(key);
+    }
+
+    template<typename R, typename C = CompareRight, typename = typename C::is_transparent>
+    Left const &at_right(R const &key) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
         return map_right.at(key);
     }
 
@@ -633,21 +2861,124 @@ struct bimap {
     // Returns iterator for corresponding elements.
     // See std::lower_bound, std::upper_bound.
     left_iterator lower_bound_left(Left const &left) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
+        return map_left.lower_bound(left);
+    }
+
+    template<typename L, typename C = CompareLeft, typename = typename C::is_transparent>
+    left_iterator lower_bound_left(L const &left) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
         return map_left.lower_bound(left);
     }
 
+    // Finger search from hint, which may be any iterator of this side including end_left().
+    left_iterator lower_bound_left(left_iterator hint, Left const &left) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
+        return map_left.lower_bound(hint, left);
+    }
+
     left_iterator upper_bound_left(Left const &left) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
+        return map_left.upper_bound(left);
+    }
+
+    template<typename L, typename C = CompareLeft, typename = typename C::is_transparent>
+    left_iterator upper_bound_left(L const &left) const {
+        auto scope = operation_<tag_left>(intrusive::lookup_operation);
         return map_left.upper_bound(left);
     }
 
     right_iterator lower_bound_right(Right const &right) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
+        return map_right.lower_bound(right);
+    }
+
+    template<typename R, typename C = CompareRight, typename = typename C::is_transparent>
+    right_iterator lower_bound_right(R const &right) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
         return map_right.lower_bound(right);
     }
 
+    right_iterator lower_bound_right(right_iterator hint, Right const &right) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
+        return map_right.lower_bound(hint, right);
+    }
+
     right_iterator upper_bound_right(Right const &right) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
+        return map_right.upper_bound(right);
+    }
+
+    template<typename R, typename C = CompareRight, typename = typename C::is_transparent>
+    right_iterator upper_bound_right(R const &right) const {
+        auto scope = operation_<tag_right>(intrusive::lookup_operation);
         return map_right.upper_bound(right);
     }
 
+    // Order statistics, available with Policy::order_statistics.
+    // Return iterator to the k-th (from zero) element or end() if k >= size().
+    // Iterators also have index() and logarithmic distance (use unqualified distance with using std::distance).
+    template<typename P = Policy, std::enable_if_t<P::order_statistics, bool> = true>
+    left_iterator nth_left(std::size_t k) const {
+        return map_left.nth(k);
+    }
+
+    template<typename P = Policy, std::enable_if_t<P::order_statistics, bool> = true>
+    right_iterator nth_right(std::size_t k) const {
+        return map_right.nth(k);
+    }
+
+    // Return the number of elements less than key.
+    template<typename P = Policy, std::enable_if_t<P::order_statistics, bool> = true>
+    std::size_t rank_left(Left const &left) const {
+        return map_left.rank(left);
+    }
+
+    template<typename P = Policy, std::enable_if_t<P::order_statistics, bool> = true>
+    std::size_t rank_right(Right const &right) const {
+        return map_right.rank(right);
+    }
+
+    // Elements of [from, to) of a side, the view can be used in range-for and copying it allocates nothing.
+    // It is empty unless from < to.
+    intrusive::map_range<left_iterator> range_left(Left const &from, Left const &to) const {
+        return map_left.range(from, to);
+    }
+
+    intrusive::map_range<right_iterator> range_right(Right const &from, Right const &to) const {
+        return map_right.range(from, to);
+    }
+
+    // Number of elements of [from, to) in O(log n) without walking the range.
+    template<typename P = Policy, std::enable_if_t<P::order_statistics, bool> = true>
+    std::size_t count_range_left(Left const &from, Left const &to) const {
+        return map_left.count_range(from, to);
+    }
+
+    template<typename P = Policy, std::enable_if_t<P::order_statistics, bool> = true>
+    std::size_t count_range_right(Right const &from, Right const &to) const {
+        return map_right.count_range(from, to);
+    }
+
+    // Snapshot of the counters kept with Policy::statistics (see intrusive::bimap_statistics),
+    // heights of the trees are found by walks in O(n). Counters are not copied with the bimap.
+    template<typename P = Policy, std::enable_if_t<P::statistics, bool> = true>
+    intrusive::bimap_statistics statistics() const {
+        intrusive::bimap_statistics res;
+        res.left = map_left.statistics();
+        res.right = map_right.statistics();
+        res.size = sz;
+        res.allocations = map_left.allocations.get();
+        res.frees = map_left.frees.get();
+        return res;
+    }
+
+    template<typename P = Policy, std::enable_if_t<P::statistics, bool> = true>
+    void reset_statistics() noexcept {
+        map_left.reset_statistics();
+        map_right.reset_statistics();
+    }
+
     // Returns iterator for the min left.
     left_iterator begin_left() const {
         return map_left.begin();
@@ -676,39 +3007,473 @@ struct bimap {
         return sz;
     }
 
+    // The allocator sharing memory with this bimap, for slab_allocator its pool is created if it is lazy.
+    Allocator get_allocator() const {
+        if constexpr (intrusive::has_share<allocator_type>::value) {
+            return Allocator(alloc.share());
+        } else {
+            return Allocator(alloc);
+        }
+    }
+
     void swap(bimap &other) noexcept {
         map_left.swap(other.map_left);
         map_right.swap(other.map_right);
+        std::swap(alloc, other.alloc);
         std::swap(sz, other.sz);
+        if constexpr (Policy::fingerprint) {
+            std::swap(this->fingerprint_value, other.fingerprint_value);
+        }
     }
 
     // comparison operators
+    // Bimaps with different fingerprints differ if the hashes agree with the comparators (see fingerprint_exact_),
+    // equal ones are still compared pair by pair.
+    // Integral and enum keys ordered by std::less or std::greater are gathered in blocks and compared by == in bulk.
     friend bool operator==(bimap const &a, bimap const &b) {
         if (a.sz != b.sz) {
             return false;
         }
-        for (left_iterator it1 = a.begin_left(), it2 = b.begin_left(); it1 != a.end_left(); ++it1, ++it2) {
-            if (!a.map_left.equals(*it1, *it2) || !a.map_right.equals(*it1.flip(), *it2.flip())) {
+        if constexpr (fingerprint_exact_) {
+            if (a.fingerprint_value != b.fingerprint_value) {
                 return false;
             }
         }
-        return true;
+        return equal_pairs_(a, b, std::bool_constant<intrusive::plain_equality<Left, CompareLeft> &&
+                                                     intrusive::plain_equality<Right, CompareRight>>());
     }
 
     friend bool operator!=(bimap const &a, bimap const &b) {
         return !(a == b);
     }
 
+    // Order-independent 64-bit hash of all pairs by Policy::fingerprint_hash of keys (std::hash by default),
+    // maintained in O(1) per insertion and erasure. Equal bimaps have equal fingerprints as long as keys equivalent
+    // by the comparators have equal hashes: true for std::hash of integral, enum and string keys ordered by
+    // std::less or std::greater, promised by Policy::fingerprint_hash_exact otherwise. A case-insensitive
+    // comparator with std::hash breaks it. Comparing fingerprints of replicas detects a drift in O(1) with a false
+    // match probability about 2^-64. It is the same in other processes as long as the hash is.
+    template<typename P = Policy, std::enable_if_t<P::fingerprint, bool> = true>
+    std::uint64_t fingerprint() const noexcept {
+        return this->fingerprint_value;
+    }
+
 private:
-    bimap(CompareLeft &&compare_left, CompareRight &&compare_right, size_t sz) noexcept
-            : map_left(std::move(compare_left)), map_right(std::move(compare_right)), sz(sz) {}
+    // Whether different fingerprints prove bimaps unequal
+    static constexpr bool fingerprint_exact_ =
+            Policy::fingerprint && (Policy::fingerprint_hash_exact ||
+                                    (intrusive::exact_hash<Left, CompareLeft,
+                                            typename Policy::template fingerprint_hash<Left>> &&
+                                     intrusive::exact_hash<Right, CompareRight,
+                                             typename Policy::template fingerprint_hash<Right>>));
+
+    // Smaller merges are not worth starting threads
+    static constexpr std::size_t parallel_merge_size = std::size_t(1) << 15;
+    // Pairs compared at once by equal_pairs_
+    static constexpr std::size_t equality_block = 64;
+    // load reads an image of unknown length by at least this many bytes at once
+    static constexpr std::size_t image_read_chunk = std::size_t(1) << 20;
+
+    bimap(CompareLeft &&compare_left, CompareRight &&compare_right, allocator_type &&alloc, size_t sz) noexcept
+            : map_left(std::move(compare_left)), map_right(std::move(compare_right)), alloc(std::move(alloc)), sz(sz) {
+        link_ends_();
+    }
+
+    // end_left().flip() == end_right() and vice versa
+    void link_ends_() noexcept {
+        map_left.fake.right = &map_right.fake;
+        map_right.fake.right = &map_left.fake;
+    }
+
+    template<typename... Args>
+    node_t *new_node_(Args &&... args) {
+        node_t *nd = allocator_traits::allocate(alloc, 1);
+        try {
+            allocator_traits::construct(alloc, nd, std::forward<Args>(args)...);
+        } catch (...) {
+            allocator_traits::deallocate(alloc, nd, 1);
+            throw;
+        }
+        if constexpr (Policy::statistics) {
+            map_left.allocations.add();
+        }
+        return nd;
+    }
+
+    void delete_node_(node_t *nd) noexcept {
+        allocator_traits::destroy(alloc, nd);
+        allocator_traits::deallocate(alloc, nd, 1);
+        if constexpr (Policy::statistics) {
+            map_left.frees.add();
+        }
+    }
+
+    template<typename L, typename... Args>
+    left_iterator try_emplace_left_(L &&left, Args &&... right_args) {
+        auto scope = operation_<tag_left>(intrusive::insert_operation);
+        auto left_pos = map_left.find_insert_position(left);
+        if (left_pos.found != nullptr) {
+            return end_left();
+        }
+        node_t *nd = new_node_(std::piecewise_construct, std::forward_as_tuple(std::forward<L>(left)),
+                               std::forward_as_tuple(std::forward<Args>(right_args)...), intrusive::next_priority());
+        auto right_pos = map_right.find_insert_position(nd->get_right());
+        if (right_pos.found != nullptr) {
+            delete_node_(nd);
+            return end_left();
+        }
+        return link_(left_pos, right_pos, nd);
+    }
+
+    template<typename R, typename... Args>
+    right_iterator try_emplace_right_(R &&right, Args &&... left_args) {
+        auto scope = operation_<tag_right>(intrusive::insert_operation);
+        auto right_pos = map_right.find_insert_position(right);
+        if (right_pos.found != nullptr) {
+            return end_right();
+        }
+        node_t *nd = new_node_(std::piecewise_construct, std::forward_as_tuple(std::forward<Args>(left_args)...),
+                               std::forward_as_tuple(std::forward<R>(right)), intrusive::next_priority());
+        auto left_pos = map_left.find_insert_position(nd->get_left());
+        if (left_pos.found != nullptr) {
+            delete_node_(nd);
+            return end_right();
+        }
+        return link_(left_pos, right_pos, nd).flip();
+    }
+
+    using left_position = typename intrusive::map<Left, Right, CompareLeft, tag_left, Policy>::insert_position;
+    using right_position = typename intrusive::map<Right, Left, CompareRight, tag_right, Policy>::insert_position;
+
+    // Links a node to places found on both sides, nothing may change in bimap after they were found.
+    left_iterator link_(left_position const &left_pos, right_position const &right_pos, node_t *nd) {
+        map_left.link(left_pos, &intrusive::to_base<node_t, tag_left>(*nd));
+        map_right.link(right_pos, &intrusive::to_base<node_t, tag_right>(*nd));
+        ++sz;
+        fingerprint_add_(nd);
+        return left_iterator(&intrusive::to_base<node_t, tag_left>(*nd));
+    }
+
+    node_type extract_(node_t *nd) noexcept {
+        map_left.unlink(&intrusive::to_base<node_t, tag_left>(*nd));
+        map_right.unlink(&intrusive::to_base<node_t, tag_right>(*nd));
+        --sz;
+        fingerprint_sub_(nd);
+        return node_type(nd, alloc);
+    }
+
+    // Pairs of bimaps of the same size by the comparators.
+    static bool equal_pairs_(bimap const &a, bimap const &b, std::false_type) {
+        for (left_iterator it1 = a.begin_left(), it2 = b.begin_left(); it1 != a.end_left(); ++it1, ++it2) {
+            if (!a.map_left.equals(*it1, *it2) || !a.map_right.equals(*it1.flip(), *it2.flip())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The same by ==, pairs are gathered by blocks of equality_block.
+    template<typename L = Left, typename R = Right>
+    static bool equal_pairs_(bimap const &a, bimap const &b, std::true_type) {
+        // The tail of the last block stays zero in both
+        L lefts_a[equality_block]{}, lefts_b[equality_block]{};
+        R rights_a[equality_block]{}, rights_b[equality_block]{};
+        left_iterator it_a = a.begin_left(), it_b = b.begin_left();
+        for (std::size_t done = 0; done < a.sz;) {
+            std::size_t m = std::min(equality_block, a.sz - done);
+            for (std::size_t i = 0; i < m; ++i, ++it_a, ++it_b) {
+                lefts_a[i] = *it_a;
+                lefts_b[i] = *it_b;
+                rights_a[i] = *it_a.flip();
+                rights_b[i] = *it_b.flip();
+            }
+            if (!intrusive::equal_keys(lefts_a, lefts_b) || !intrusive::equal_keys(rights_a, rights_b)) {
+                return false;
+            }
+            done += m;
+        }
+        return true;
+    }
+
+    // Accounts a linked or an unlinked pair, does nothing without Policy::fingerprint.
+    void fingerprint_add_(node_t const *nd) noexcept {
+        if constexpr (Policy::fingerprint) {
+            this->fingerprint_value += intrusive::pair_hash<Policy>(nd->get_left(), nd->get_right());
+        }
+    }
+
+    void fingerprint_sub_(node_t const *nd) noexcept {
+        if constexpr (Policy::fingerprint) {
+            this->fingerprint_value -= intrusive::pair_hash<Policy>(nd->get_left(), nd->get_right());
+        }
+    }
+
+    // Frees all nodes, links of both trees are left dangling.
+    // A pool which is not shared is released at once if keys need no destructors, otherwise the left tree
+    // is flattened by right rotations on the fly and freed from the smallest node, so each node is visited O(1) times.
+    void destroy_nodes_() noexcept {
+        if constexpr (intrusive::has_release<allocator_type>::value &&
+                      std::is_trivially_destructible_v<Left> && std::is_trivially_destructible_v<Right>) {
+            if (alloc.release()) {
+                if constexpr (Policy::statistics) {
+                    map_left.frees.add(sz);
+                }
+                return;
+            }
+        }
+        node_base *t = map_left.fake.left;
+        while (t != nullptr) {
+            if (t->left != nullptr) {
+                node_base *l = t->left;
+                t->left = l->right;
+                l->right = t;
+                t = l;
+            } else {
+                node_base *next = t->right;
+                delete_node_(&intrusive::from_base<node_t, tag_left>(*t));
+                t = next;
+            }
+        }
+    }
+
+    // Accounts an operation which started from the Tag side, does nothing without Policy::statistics.
+    template<typename Tag>
+    auto operation_(intrusive::operation_kind kind) const noexcept {
+        if constexpr (Policy::statistics) {
+            if constexpr (std::is_same_v<Tag, tag_left>) {
+                return intrusive::operation_scope<true>(&map_left.operations[kind]);
+            } else {
+                return intrusive::operation_scope<true>(&map_right.operations[kind]);
+            }
+        } else {
+            return intrusive::operation_scope<false>(nullptr);
+        }
+    }
+
+    // Frees nodes of the tree t which was cut out from the Tag side and unlinks them from the other side.
+    template<typename Tag>
+    void erase_cut_(node_base *t) noexcept {
+        using opposite_tag = std::conditional_t<std::is_same_v<Tag, tag_left>, tag_right, tag_left>;
+        while (t != nullptr) {
+            if (t->left != nullptr) {
+                node_base *l = t->left;
+                t->left = l->right;
+                l->right = t;
+                t = l;
+            } else {
+                node_base *next = t->right;
+                node_t *nd = &intrusive::from_base<node_t, Tag>(*t);
+                if constexpr (std::is_same_v<Tag, tag_left>) {
+                    map_right.unlink(&intrusive::to_base<node_t, opposite_tag>(*nd));
+                } else {
+                    map_left.unlink(&intrusive::to_base<node_t, opposite_tag>(*nd));
+                }
+                fingerprint_sub_(nd);
+                delete_node_(nd);
+                --sz;
+                t = next;
+            }
+        }
+    }
+
+    // Whether nodes of other can be freed by alloc.
+    bool adopt_memory_(bimap &other) {
+        if (alloc == other.alloc) {
+            return true;
+        }
+        if constexpr (intrusive::has_absorb<allocator_type>::value) {
+            return alloc.absorb(other.alloc);
+        } else {
+            return false;
+        }
+    }
+
+    // Removes pairs of other whose key of the Tag side is also here.
+    // Both trees are walked in order if they have comparable sizes, otherwise keys of other are looked up.
+    template<typename Tag>
+    void drop_conflicts_(bimap &other) {
+        auto &mine = get_map_<Tag>();
+        auto &theirs = other.template get_map_<Tag>();
+        std::vector<node_t *> conflicts;
+        auto conflict = [&](auto it) {
+            conflicts.push_back(const_cast<node_t *>(&intrusive::from_base<node_t, Tag>(*it.get_data())));
+        };
+        std::size_t log_size = 1;
+        while ((std::size_t(1) << log_size) < sz) {
+            ++log_size;
+        }
+        if (other.sz * log_size > sz) {
+            auto a = mine.begin();
+            for (auto b = theirs.begin(); a != mine.end() && b != theirs.end();) {
+                if (mine.cmp(*a, *b)) {
+                    ++a;
+                } else if (mine.cmp(*b, *a)) {
+                    ++b;
+                } else {
+                    conflict(b++);
+                    ++a;
+                }
+            }
+        } else {
+            for (auto b = theirs.begin(); b != theirs.end(); ++b) {
+                if (mine.find(*b) != mine.end()) {
+                    conflict(b);
+                }
+            }
+        }
+        // The memory of other belongs to alloc now
+        for (node_t *nd : conflicts) {
+            other.map_left.unlink(&intrusive::to_base<node_t, tag_left>(*nd));
+            other.map_right.unlink(&intrusive::to_base<node_t, tag_right>(*nd));
+            other.fingerprint_sub_(nd);
+            delete_node_(nd);
+            --other.sz;
+        }
+    }
+
+    template<typename Tag>
+    auto &get_map_() noexcept {
+        if constexpr (std::is_same_v<Tag, tag_left>) {
+            return map_left;
+        } else {
+            return map_right;
+        }
+    }
+
+    // Invariant: bimap is empty
+    template<typename InputIt>
+    void build_(InputIt first, InputIt last, bool sorted_left) {
+        std::vector<node_t *> nodes;
+        std::vector<node_base *> left_order, right_order;
+        std::vector<bool> accepted;
+        try {
+            for (; first != last; ++first) {
+                nodes.push_back(nullptr);
+                nodes.back() = new_node_(first->first, first->second, intrusive::next_priority());
+            }
+
+            std::size_t n = nodes.size();
+            std::vector<std::size_t> by_left(n), by_right(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                by_left[i] = by_right[i] = i;
+            }
+            if (!sorted_left) {
+                std::stable_sort(by_left.begin(), by_left.end(), [&](std::size_t a, std::size_t b) {
+                    return map_left.cmp(nodes[a]->get_left(), nodes[b]->get_left());
+                });
+            }
+            std::stable_sort(by_right.begin(), by_right.end(), [&](std::size_t a, std::size_t b) {
+                return map_right.cmp(nodes[a]->get_right(), nodes[b]->get_right());
+            });
+
+            // Equivalent keys get the same group, the first pair (in the range order) of each group wins.
+            std::vector<std::size_t> left_group(n), right_group(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                left_group[by_left[i]] = (i > 0 && !map_left.cmp(nodes[by_left[i - 1]]->get_left(), nodes[by_left[i]]->get_left()))
+                                         ? left_group[by_left[i - 1]] : i;
+                right_group[by_right[i]] = (i > 0 && !map_right.cmp(nodes[by_right[i - 1]]->get_right(), nodes[by_right[i]]->get_right()))
+                                           ? right_group[by_right[i - 1]] : i;
+            }
+            std::vector<bool> left_taken(n), right_taken(n);
+            accepted.resize(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                if (!left_taken[left_group[i]] && !right_taken[right_group[i]]) {
+                    left_taken[left_group[i]] = right_taken[right_group[i]] = accepted[i] = true;
+                }
+            }
+
+            for (std::size_t i = 0; i < n; ++i) {
+                if (accepted[by_left[i]]) {
+                    left_order.push_back(&intrusive::to_base<node_t, tag_left>(*nodes[by_left[i]]));
+                }
+                if (accepted[by_right[i]]) {
+                    right_order.push_back(&intrusive::to_base<node_t, tag_right>(*nodes[by_right[i]]));
+                }
+            }
+        } catch (...) {
+            for (node_t *nd : nodes) {
+                if (nd != nullptr) {
+                    delete_node_(nd);
+                }
+            }
+            throw;
+        }
+
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            if (accepted[i]) {
+                fingerprint_add_(nodes[i]);
+            } else {
+                delete_node_(nodes[i]);
+            }
+        }
+        map_left.build_sorted(left_order.begin(), left_order.end());
+        map_right.build_sorted(right_order.begin(), right_order.end());
+        sz = left_order.size();
+    }
+
+    // Links sections of an image, both arrays of keys are sorted.
+    // Invariant: bimap is empty
+    void build_image_(Left const *lefts, Right const *rights, std::uint32_t const *left_to_right,
+                      std::uint32_t const *right_to_left, std::size_t n) {
+        if (!intrusive::valid_permutations(left_to_right, right_to_left, n)) {
+            throw std::runtime_error("bimap image is malformed");
+        }
+        std::vector<node_base *> left_order(n), right_order(n);
+        std::vector<node_t *> nodes;
+        nodes.reserve(n);
+        try {
+            for (std::size_t i = 0; i < n; ++i) {
+                nodes.push_back(new_node_(lefts[i], rights[left_to_right[i]], intrusive::next_priority()));
+            }
+        } catch (...) {
+            for (node_t *nd : nodes) {
+                delete_node_(nd);
+            }
+            throw;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            left_order[i] = &intrusive::to_base<node_t, tag_left>(*nodes[i]);
+            right_order[i] = &intrusive::to_base<node_t, tag_right>(*nodes[right_to_left[i]]);
+            fingerprint_add_(nodes[i]);
+        }
+        map_left.build_sorted(left_order.begin(), left_order.end());
+        map_right.build_sorted(right_order.begin(), right_order.end());
+        sz = n;
+    }
+
+    // Bytes from the current position to the end of the stream, -1 if it is not seekable.
+    static std::streamoff remaining_bytes_(std::istream &in) {
+        std::streampos pos = in.tellg();
+        if (pos == std::streampos(-1)) {
+            in.clear();
+            return -1;
+        }
+        std::streamoff res = -1;
+        if (in.seekg(0, std::ios::end)) {
+            std::streampos end = in.tellg();
+            if (end != std::streampos(-1)) {
+                res = end - pos;
+            }
+        }
+        in.clear();
+        in.seekg(pos);
+        return res;
+    }
+
+    static void read_image_(std::istream &in, void *data, std::size_t bytes) {
+        if (!in.read(static_cast<char *>(data), static_cast<std::streamsize>(bytes))) {
+            throw std::runtime_error("bimap image is truncated");
+        }
+    }
 
 private:
-    intrusive::map<Left, Right, CompareLeft, tag_left> map_left;
-    intrusive::map<Right, Left, CompareRight, tag_right> map_right;
+    intrusive::map<Left, Right, CompareLeft, tag_left, Policy> map_left;
+    intrusive::map<Right, Left, CompareRight, tag_right, Policy> map_right;
+    allocator_type alloc;
     size_t sz;
 
-    template<typename Left1, typename Right1, typename CompareLeft1, typename CompareRight1>
+    template<typename Left1, typename Right1, typename CompareLeft1, typename CompareRight1, typename Allocator1,
+            typename Policy1>
     friend
     struct bimap;
 };
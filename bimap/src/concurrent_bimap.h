@@ -0,0 +1,361 @@
+#pragma once
+
+#include "bimap.h"
+#include "persistent_treap.h"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+namespace intrusive {
+    // Counters of readers inside of a read section, by parity of the epoch they started in.
+    // Threads are spread over slots, so readers of different cores rarely touch the same cache line.
+    struct alignas(64) reader_slot {
+        std::atomic<std::size_t> active[2] = {0, 0};
+    };
+
+    inline std::size_t reader_slot_index() noexcept {
+        static std::atomic<std::size_t> threads{0};
+        thread_local std::size_t index = threads.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+}
+
+// Bimap for many readers and writers which are much rarer.
+// Both sides are persistent treaps, a writer copies the changed paths and publishes a new version atomically.
+// find_*, at_*, size() and empty() are wait-free and may run concurrently with each other and with writers,
+// they return copies, because nodes of an old version are freed after readers leave it.
+// insert and erase_* are serialized by a mutex. Replaced nodes are freed in batches after a grace period:
+// the epoch is advanced twice and the writer waits until readers of each previous parity are gone.
+template<typename Left, typename Right, typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>,
+        typename Allocator = intrusive::slab_allocator<intrusive::persistent_node<Left, Right>>>
+struct concurrent_bimap {
+    using left_node = intrusive::persistent_node<Left, Right>;
+    using right_node = intrusive::persistent_node<Right, Left>;
+    using left_tree = intrusive::path_copying<left_node, CompareLeft>;
+    using right_tree = intrusive::path_copying<right_node, CompareRight>;
+
+    // Creates empty bimap
+    concurrent_bimap(CompareLeft compare_left = CompareLeft(), CompareRight compare_right = CompareRight(),
+                     Allocator const &alloc = Allocator())
+            : cmp_left(std::move(compare_left)), cmp_right(std::move(compare_right)),
+              left_alloc(alloc), right_alloc(alloc) {
+        current.store(new_version_(nullptr, nullptr, 0), std::memory_order_relaxed);
+    }
+
+    concurrent_bimap(concurrent_bimap const &) = delete;
+
+    concurrent_bimap &operator=(concurrent_bimap const &) = delete;
+
+    // There must be no readers and writers left.
+    ~concurrent_bimap() {
+        reclaim_();
+        version const *v = current.load(std::memory_order_relaxed);
+        destroy_tree_(v->left, left_alloc);
+        destroy_tree_(v->right, right_alloc);
+        delete v;
+    }
+
+    // Inserts pair (left, right) if neither left nor right is present.
+    // Returns whether the pair was inserted.
+    template<typename L = Left, typename R = Right>
+    bool insert(L &&left, R &&right) {
+        std::lock_guard<std::mutex> lock(writer);
+        version const *v = current.load(std::memory_order_relaxed);
+        if (left_tree::find(v->left, left, cmp_left) != nullptr ||
+            right_tree::find(v->right, right, cmp_right) != nullptr) {
+            return false;
+        }
+        int priority = intrusive::next_priority();
+        // Each side keeps its own copy of both keys, the protos give them to the new nodes
+        left_node left_proto(left, right, priority, nullptr, nullptr);
+        right_node right_proto(std::forward<R>(right), std::forward<L>(left), priority, nullptr, nullptr);
+        commit_(v, v->size + 1, [&](auto &left_owner, auto &right_owner) {
+            return std::pair{left_tree::insert(v->left, left_proto, cmp_left, left_owner),
+                             right_tree::insert(v->right, right_proto, cmp_right, right_owner)};
+        });
+        return true;
+    }
+
+    // Removes the pair of the key.
+    // Returns whether the pair was deleted or not.
+    bool erase_left(Left const &left) {
+        std::lock_guard<std::mutex> lock(writer);
+        version const *v = current.load(std::memory_order_relaxed);
+        left_node const *n = left_tree::find(v->left, left, cmp_left);
+        if (n == nullptr) {
+            return false;
+        }
+        commit_(v, v->size - 1, [&](auto &left_owner, auto &right_owner) {
+            return std::pair{left_tree::erase(v->left, n->key, cmp_left, left_owner),
+                             right_tree::erase(v->right, n->value, cmp_right, right_owner)};
+        });
+        return true;
+    }
+
+    bool erase_right(Right const &right) {
+        std::lock_guard<std::mutex> lock(writer);
+        version const *v = current.load(std::memory_order_relaxed);
+        right_node const *n = right_tree::find(v->right, right, cmp_right);
+        if (n == nullptr) {
+            return false;
+        }
+        commit_(v, v->size - 1, [&](auto &left_owner, auto &right_owner) {
+            return std::pair{left_tree::erase(v->left, n->value, cmp_left, left_owner),
+                             right_tree::erase(v->right, n->key, cmp_right, right_owner)};
+        });
+        return true;
+    }
+
+    // Returns a copy of the opposite element or nothing.
+    std::optional<Right> find_left(Left const &left) const {
+        read_section section(*this);
+        left_node const *n = left_tree::find(section.get()->left, left, cmp_left);
+        return n == nullptr ? std::nullopt : std::optional<Right>(n->value);
+    }
+
+    std::optional<Left> find_right(Right const &right) const {
+        read_section section(*this);
+        right_node const *n = right_tree::find(section.get()->right, right, cmp_right);
+        return n == nullptr ? std::nullopt : std::optional<Left>(n->value);
+    }
+
+    // Returns a copy of the opposite element.
+    // If there is no element - throws std::out_of_range.
+    Right at_left(Left const &key) const {
+        std::optional<Right> res = find_left(key);
+        if (!res) {
+            throw std::out_of_range("no such element in concurrent_bimap");
+        }
+        return std::move(*res);
+    }
+
+    Left at_right(Right const &key) const {
+        std::optional<Left> res = find_right(key);
+        if (!res) {
+            throw std::out_of_range("no such element in concurrent_bimap");
+        }
+        return std::move(*res);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    std::size_t size() const {
+        read_section section(*this);
+        return section.get()->size;
+    }
+
+    // Waits for the current readers and frees all replaced nodes.
+    void synchronize() {
+        std::lock_guard<std::mutex> lock(writer);
+        reclaim_();
+    }
+
+private:
+    // Both roots change together, so a reader never sees a pair on one side only.
+    struct version {
+        left_node const *left;
+        right_node const *right;
+        std::size_t size;
+    };
+
+    using left_alloc_t = typename std::allocator_traits<Allocator>::template rebind_alloc<left_node>;
+    using right_alloc_t = typename std::allocator_traits<Allocator>::template rebind_alloc<right_node>;
+
+    static constexpr std::size_t reader_slots = 64;
+    // The grace period is waited for once per this many replaced nodes
+    static constexpr std::size_t reclaim_batch = 4096;
+
+    struct read_section {
+        explicit read_section(concurrent_bimap const &b) noexcept
+                : slot(b.slots[intrusive::reader_slot_index() % reader_slots]),
+                  parity(b.epoch.load() & 1) {
+            // Both are seq_cst and so is the writer's pair current.store / active.load:
+            // either the writer sees this reader or this reader sees the new version
+            slot.active[parity].fetch_add(1, std::memory_order_seq_cst);
+            v = b.current.load(std::memory_order_seq_cst);
+        }
+
+        read_section(read_section const &) = delete;
+
+        read_section &operator=(read_section const &) = delete;
+
+        ~read_section() {
+            slot.active[parity].fetch_sub(1, std::memory_order_release);
+        }
+
+        version const *get() const noexcept {
+            return v;
+        }
+
+    private:
+        intrusive::reader_slot &slot;
+        std::size_t parity;
+        version const *v;
+    };
+
+    // Owner of path_copying for a writer: remembers new nodes to free them if the update fails
+    // and replaced nodes to retire them if it succeeds.
+    template<typename Node, typename Alloc>
+    struct writer_owner {
+        using traits = std::allocator_traits<Alloc>;
+
+        explicit writer_owner(Alloc &alloc) noexcept
+                : alloc(alloc) {}
+
+        writer_owner(writer_owner const &) = delete;
+
+        writer_owner &operator=(writer_owner const &) = delete;
+
+        ~writer_owner() {
+            for (Node *n : created) {
+                traits::destroy(alloc, n);
+                traits::deallocate(alloc, n, 1);
+            }
+        }
+
+        Node const *share(Node const *n) noexcept {
+            return n;
+        }
+
+        Node const *copy(Node const &n, Node const *left, Node const *right) {
+            return create_(n.key, n.value, n.priority, left, right);
+        }
+
+        Node const *copy(Node &&n, Node const *left, Node const *right) {
+            return create_(std::move(n.key), std::move(n.value), n.priority, left, right);
+        }
+
+        void replaced(Node const *n) {
+            replaced_nodes.push_back(n);
+        }
+
+        void reserve_retired(std::vector<Node const *> &retired) {
+            retired.reserve(retired.size() + replaced_nodes.size());
+        }
+
+        // New nodes belong to the published version now.
+        void commit(std::vector<Node const *> &retired) {
+            retired.insert(retired.end(), replaced_nodes.begin(), replaced_nodes.end());
+            created.clear();
+        }
+
+    private:
+        template<typename K, typename V>
+        Node const *create_(K &&key, V &&value, int priority, Node const *left, Node const *right) {
+            created.reserve(created.size() + 1);
+            Node *res = traits::allocate(alloc, 1);
+            try {
+                traits::construct(alloc, res, std::forward<K>(key), std::forward<V>(value), priority, left, right);
+            } catch (...) {
+                traits::deallocate(alloc, res, 1);
+                throw;
+            }
+            created.push_back(res);
+            return res;
+        }
+
+        Alloc &alloc;
+        std::vector<Node *> created;
+        std::vector<Node const *> replaced_nodes;
+    };
+
+    // Builds both new roots with update and publishes them, the caller holds the writer mutex.
+    template<typename Update>
+    void commit_(version const *v, std::size_t size, Update update) {
+        writer_owner<left_node, left_alloc_t> left_owner(left_alloc);
+        writer_owner<right_node, right_alloc_t> right_owner(right_alloc);
+        auto [left, right] = update(left_owner, right_owner);
+        left_owner.reserve_retired(retired_left);
+        right_owner.reserve_retired(retired_right);
+        retired_versions.reserve(retired_versions.size() + 1);
+        version *next = new_version_(left, right, size);
+
+        retired_versions.push_back(v);
+        left_owner.commit(retired_left);
+        right_owner.commit(retired_right);
+        current.store(next, std::memory_order_seq_cst);
+        if (retired_left.size() + retired_right.size() >= reclaim_batch) {
+            reclaim_();
+        }
+    }
+
+    // Versions are allocated with new, so that they do not fix the node size of a shared slab_pool.
+    static version *new_version_(left_node const *left, right_node const *right, std::size_t size) {
+        return new version{left, right, size};
+    }
+
+    // Grace period: every reader which could see a retired node has left its read section after it.
+    void wait_for_readers_() const {
+        for (std::size_t phase = 0; phase < 2; ++phase) {
+            std::size_t parity = epoch.fetch_add(1) & 1;
+            for (auto &slot : slots) {
+                while (slot.active[parity].load(std::memory_order_seq_cst) != 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    void reclaim_() {
+        if (retired_left.empty() && retired_right.empty() && retired_versions.empty()) {
+            return;
+        }
+        wait_for_readers_();
+        free_nodes_(retired_left, left_alloc);
+        free_nodes_(retired_right, right_alloc);
+        for (version const *v : retired_versions) {
+            delete v;
+        }
+        retired_versions.clear();
+    }
+
+    template<typename Node, typename Alloc>
+    static void free_nodes_(std::vector<Node const *> &nodes, Alloc &alloc) noexcept {
+        for (Node const *n : nodes) {
+            std::allocator_traits<Alloc>::destroy(alloc, n);
+            std::allocator_traits<Alloc>::deallocate(alloc, const_cast<Node *>(n), 1);
+        }
+        nodes.clear();
+    }
+
+    template<typename Node, typename Alloc>
+    static void destroy_tree_(Node const *t, Alloc &alloc) noexcept {
+        std::vector<Node const *> stack;
+        if (t != nullptr) {
+            stack.push_back(t);
+        }
+        while (!stack.empty()) {
+            Node const *n = stack.back();
+            stack.pop_back();
+            if (n->left != nullptr) {
+                stack.push_back(n->left);
+            }
+            if (n->right != nullptr) {
+                stack.push_back(n->right);
+            }
+            std::allocator_traits<Alloc>::destroy(alloc, n);
+            std::allocator_traits<Alloc>::deallocate(alloc, const_cast<Node *>(n), 1);
+        }
+    }
+
+private:
+    CompareLeft cmp_left;
+    CompareRight cmp_right;
+    std::atomic<version const *> current;
+    mutable std::atomic<std::size_t> epoch{0};
+    mutable std::array<intrusive::reader_slot, reader_slots> slots;
+
+    // Writer state
+    std::mutex writer;
+    left_alloc_t left_alloc;
+    right_alloc_t right_alloc;
+    std::vector<left_node const *> retired_left;
+    std::vector<right_node const *> retired_right;
+    std::vector<version const *> retired_versions;
+};
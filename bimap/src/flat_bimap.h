@@ -0,0 +1,536 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <limits>
+#include <stdexcept>
+
+template<typename Left, typename Right, typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>>
+struct flat_bimap;
+
+template<typename Left, typename Right, typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>>
+struct mapped_bimap;
+
+namespace intrusive {
+    // Both sides as sorted arrays, a pair is linked by indices: left_to_right[i] is the position in rights
+    // of the element paired with lefts[i], right_to_left is the inverse permutation.
+    template<typename Left, typename Right>
+    struct flat_storage {
+        using index_t = std::uint32_t;
+
+        std::vector<Left> lefts;
+        std::vector<Right> rights;
+        std::vector<index_t> left_to_right;
+        std::vector<index_t> right_to_left;
+
+        template<typename Tag>
+        auto const &keys() const noexcept {
+            if constexpr (std::is_same_v<Tag, tag_left>) {
+                return lefts;
+            } else {
+                return rights;
+            }
+        }
+
+        template<typename Tag>
+        std::vector<index_t> const &to_opposite() const noexcept {
+            if constexpr (std::is_same_v<Tag, tag_left>) {
+                return left_to_right;
+            } else {
+                return right_to_left;
+            }
+        }
+    };
+
+    // Lower bound without branches on the comparison result: the step only chooses the base,
+    // which compiles to a conditional move, so mispredictions do not depend on the keys.
+    template<typename Key, typename K, typename Compare>
+    std::size_t branchless_lower_bound(Key const *data, std::size_t n, K const &key, Compare const &cmp) {
+        if (n == 0) {
+            return 0;
+        }
+        Key const *base = data;
+        while (n > 1) {
+            std::size_t half = n / 2;
+            prefetch(base + half / 2);
+            prefetch(base + half + half / 2);
+            base = cmp(base[half], key) ? base + half : base;
+            n -= half;
+        }
+        return static_cast<std::size_t>(base - data) + cmp(*base, key);
+    }
+
+    // Random access iterator over one side of flat_bimap or of another storage with the same interface.
+    template<typename Key, typename Value, typename Tag,
+            typename Storage = std::conditional_t<std::is_same_v<Tag, tag_left>, flat_storage<Key, Value>, flat_storage<Value, Key>>>
+    struct flat_iterator {
+        using iterator = flat_iterator<Key, Value, Tag, Storage>;
+        using storage_t = Storage;
+
+        using opposite_tag_t = std::conditional_t<std::is_same_v<Tag, tag_left>, tag_right, tag_left>;
+        using opposite_iterator = flat_iterator<Value, Key, opposite_tag_t, Storage>;
+
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = Key;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Key const *;
+        using reference = Key const &;
+
+        flat_iterator()
+                : storage(nullptr), pos(0) {}
+
+        // Dereferencing end() or invalid iterator is undefined.
+        Key const &operator*() const {
+            return storage->template keys<Tag>()[pos];
+        }
+
+        Key const *operator->() const {
+            return &**this;
+        }
+
+        Key const &operator[](difference_type n) const {
+            return *(*this + n);
+        }
+
+        iterator &operator++() {
+            ++pos;
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator copy = *this;
+            ++pos;
+            return copy;
+        }
+
+        iterator &operator--() {
+            --pos;
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator copy = *this;
+            --pos;
+            return copy;
+        }
+
+        iterator &operator+=(difference_type n) {
+            pos += n;
+            return *this;
+        }
+
+        iterator &operator-=(difference_type n) {
+            pos -= n;
+            return *this;
+        }
+
+        friend iterator operator+(iterator it, difference_type n) {
+            return it += n;
+        }
+
+        friend iterator operator+(difference_type n, iterator it) {
+            return it += n;
+        }
+
+        friend iterator operator-(iterator it, difference_type n) {
+            return it -= n;
+        }
+
+        friend difference_type operator-(iterator const &a, iterator const &b) {
+            return static_cast<difference_type>(a.pos) - static_cast<difference_type>(b.pos);
+        }
+
+        // Iterator of the other element of the same pair, end().flip() is the opposite end().
+        opposite_iterator flip() const {
+            auto const &opposite = storage->template to_opposite<Tag>();
+            return opposite_iterator(storage, pos < opposite.size() ? opposite[pos] : opposite.size());
+        }
+
+        // Position in the sorted order of the side.
+        std::size_t index() const noexcept {
+            return pos;
+        }
+
+        friend bool operator==(iterator const &a, iterator const &b) {
+            return a.pos == b.pos;
+        }
+
+        friend bool operator!=(iterator const &a, iterator const &b) {
+            return a.pos != b.pos;
+        }
+
+        friend bool operator<(iterator const &a, iterator const &b) {
+            return a.pos < b.pos;
+        }
+
+        friend bool operator>(iterator const &a, iterator const &b) {
+            return b < a;
+        }
+
+        friend bool operator<=(iterator const &a, iterator const &b) {
+            return !(b < a);
+        }
+
+        friend bool operator>=(iterator const &a, iterator const &b) {
+            return !(a < b);
+        }
+
+    private:
+        flat_iterator(storage_t const *storage, std::size_t pos)
+                : storage(storage), pos(pos) {}
+
+    private:
+        storage_t const *storage;
+        std::size_t pos;
+
+        template<typename Key1, typename Value1, typename Tag1, typename Storage1>
+        friend
+        struct flat_iterator;
+
+        template<typename Left1, typename Right1, typename CompareLeft1, typename CompareRight1>
+        friend
+        struct ::flat_bimap;
+
+        template<typename Left1, typename Right1, typename CompareLeft1, typename CompareRight1>
+        friend
+        struct ::mapped_bimap;
+    };
+}
+
+// Bimap for mappings which are mostly read: both sides are sorted arrays linked by two index permutations,
+// so a pair takes sizeof(Left) + sizeof(Right) + 8 bytes and lookups are binary searches over contiguous keys.
+// It is meant for small trivially copyable keys (int, std::uint64_t), but works with any copyable ones.
+// Single inserts and erases shift the arrays in O(n), batches of pairs are inserted by one linear rebuild.
+// Every modification invalidates all iterators, so do moving and swapping.
+template<typename Left, typename Right, typename CompareLeft, typename CompareRight>
+struct flat_bimap {
+    using tag_left = intrusive::tag_left;
+    using tag_right = intrusive::tag_right;
+    using storage_t = intrusive::flat_storage<Left, Right>;
+    using index_t = typename storage_t::index_t;
+
+    using left_iterator = intrusive::flat_iterator<Left, Right, tag_left>;
+    using right_iterator = intrusive::flat_iterator<Right, Left, tag_right>;
+
+    // Creates empty bimap
+    flat_bimap(CompareLeft compare_left = CompareLeft(), CompareRight compare_right = CompareRight())
+            : cmp_left(std::move(compare_left)), cmp_right(std::move(compare_right)) {}
+
+    // Bulk build from range of pairs, the result is the same as after inserting them one by one.
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    flat_bimap(InputIt first, InputIt last, CompareLeft compare_left = CompareLeft(),
+               CompareRight compare_right = CompareRight())
+            : flat_bimap(std::move(compare_left), std::move(compare_right)) {
+        insert_batch(first, last);
+    }
+
+    // Inserting pair (left, right) returns left iterator.
+    // If left or right is already in bimap, there is no insertion and returns end_left().
+    template<typename L = Left, typename R = Right>
+    left_iterator insert(L &&left, R &&right) {
+        if (find_left(left) != end_left() || find_right(right) != end_right()) {
+            return end_left();
+        }
+        std::vector<std::pair<Left, Right>> added;
+        added.emplace_back(std::forward<L>(left), std::forward<R>(right));
+        rebuild_(added, {});
+        return find_left(added.front().first);
+    }
+
+    // Inserts pairs of [first, last) as if one by one and returns the number of inserted pairs.
+    // New pairs are sorted and merged into both arrays at once.
+    template<typename InputIt>
+    std::size_t insert_batch(InputIt first, InputIt last) {
+        std::vector<std::pair<Left, Right>> candidates;
+        for (; first != last; ++first) {
+            if (find_left(first->first) == end_left() && find_right(first->second) == end_right()) {
+                candidates.emplace_back(first->first, first->second);
+            }
+        }
+        std::vector<std::pair<Left, Right>> added = first_wins_(std::move(candidates));
+        rebuild_(added, {});
+        return added.size();
+    }
+
+    // Removes an element and its corresponding paired in O(n), returns the iterator after it.
+    // erase of invalid iterator or end() is undefined.
+    left_iterator erase_left(left_iterator it) {
+        std::vector<bool> removed(size());
+        removed[it.index()] = true;
+        rebuild_({}, removed);
+        return left_iterator(&storage, it.index());
+    }
+
+    // Returns whether the pair was deleted or not.
+    bool erase_left(Left const &left) {
+        left_iterator it = find_left(left);
+        if (it == end_left()) {
+            return false;
+        }
+        erase_left(it);
+        return true;
+    }
+
+    right_iterator erase_right(right_iterator it) {
+        std::size_t pos = it.index();
+        erase_left(it.flip());
+        return right_iterator(&storage, pos);
+    }
+
+    bool erase_right(Right const &right) {
+        right_iterator it = find_right(right);
+        if (it == end_right()) {
+            return false;
+        }
+        erase_right(it);
+        return true;
+    }
+
+    // Removes all pairs whose left satisfies pred by one rebuild, returns the number of removed pairs.
+    template<typename Predicate>
+    std::size_t erase_left_if(Predicate pred) {
+        std::vector<bool> removed(size());
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < size(); ++i) {
+            if (pred(storage.lefts[i])) {
+                removed[i] = true;
+                ++count;
+            }
+        }
+        if (count > 0) {
+            rebuild_({}, removed);
+        }
+        return count;
+    }
+
+    // Returns element's iterator or end() if the element wasn't found.
+    left_iterator find_left(Left const &left) const {
+        return find_<tag_left>(left, cmp_left);
+    }
+
+    right_iterator find_right(Right const &right) const {
+        return find_<tag_right>(right, cmp_right);
+    }
+
+    // Returns an opposite element by element.
+    // If there is no element - throws std::out_of_range.
+    Right const &at_left(Left const &key) const {
+        left_iterator it = find_left(key);
+        if (it == end_left()) {
+            throw std::out_of_range("no such element in flat_bimap");
+        }
+        return *it.flip();
+    }
+
+    Left const &at_right(Right const &key) const {
+        right_iterator it = find_right(key);
+        if (it == end_right()) {
+            throw std::out_of_range("no such element in flat_bimap");
+        }
+        return *it.flip();
+    }
+
+    // See std::lower_bound, std::upper_bound.
+    left_iterator lower_bound_left(Left const &left) const {
+        return left_iterator(&storage, lower_bound_(storage.lefts, left, cmp_left));
+    }
+
+    left_iterator upper_bound_left(Left const &left) const {
+        return left_iterator(&storage, upper_bound_(storage.lefts, left, cmp_left));
+    }
+
+    right_iterator lower_bound_right(Right const &right) const {
+        return right_iterator(&storage, lower_bound_(storage.rights, right, cmp_right));
+    }
+
+    right_iterator upper_bound_right(Right const &right) const {
+        return right_iterator(&storage, upper_bound_(storage.rights, right, cmp_right));
+    }
+
+    left_iterator begin_left() const {
+        return left_iterator(&storage, 0);
+    }
+
+    left_iterator end_left() const {
+        return left_iterator(&storage, size());
+    }
+
+    right_iterator begin_right() const {
+        return right_iterator(&storage, 0);
+    }
+
+    right_iterator end_right() const {
+        return right_iterator(&storage, size());
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    std::size_t size() const {
+        return storage.lefts.size();
+    }
+
+    void swap(flat_bimap &other) noexcept {
+        std::swap(storage, other.storage);
+        std::swap(cmp_left, other.cmp_left);
+        std::swap(cmp_right, other.cmp_right);
+    }
+
+    friend bool operator==(flat_bimap const &a, flat_bimap const &b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            Left const &l1 = a.storage.lefts[i], &l2 = b.storage.lefts[i];
+            Right const &r1 = a.storage.rights[a.storage.left_to_right[i]];
+            Right const &r2 = b.storage.rights[b.storage.left_to_right[i]];
+            if (a.cmp_left(l1, l2) || a.cmp_left(l2, l1) || a.cmp_right(r1, r2) || a.cmp_right(r2, r1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend bool operator!=(flat_bimap const &a, flat_bimap const &b) {
+        return !(a == b);
+    }
+
+private:
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    template<typename Tag, typename Key, typename Compare>
+    auto find_(Key const &key, Compare const &cmp) const {
+        auto const &keys = storage.template keys<Tag>();
+        std::size_t pos = lower_bound_(keys, key, cmp);
+        if (pos != keys.size() && cmp(key, keys[pos])) {
+            pos = keys.size();
+        }
+        return intrusive::flat_iterator<Key, std::conditional_t<std::is_same_v<Tag, tag_left>, Right, Left>, Tag>(
+                &storage, pos);
+    }
+
+    template<typename Key, typename Compare>
+    static std::size_t lower_bound_(std::vector<Key> const &keys, Key const &key, Compare const &cmp) {
+        return intrusive::branchless_lower_bound(keys.data(), keys.size(), key, cmp);
+    }
+
+    template<typename Key, typename Compare>
+    static std::size_t upper_bound_(std::vector<Key> const &keys, Key const &key, Compare const &cmp) {
+        return intrusive::branchless_lower_bound(keys.data(), keys.size(), key,
+                                                 [&cmp](Key const &a, Key const &b) { return !cmp(b, a); });
+    }
+
+    // Keeps pairs which would be inserted one by one into an empty bimap: the first pair of each left
+    // and each right wins, pairs are returned in the original order.
+    std::vector<std::pair<Left, Right>> first_wins_(std::vector<std::pair<Left, Right>> candidates) const {
+        std::size_t n = candidates.size();
+        std::vector<std::size_t> by_left(n), by_right(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            by_left[i] = by_right[i] = i;
+        }
+        std::stable_sort(by_left.begin(), by_left.end(), [&](std::size_t a, std::size_t b) {
+            return cmp_left(candidates[a].first, candidates[b].first);
+        });
+        std::stable_sort(by_right.begin(), by_right.end(), [&](std::size_t a, std::size_t b) {
+            return cmp_right(candidates[a].second, candidates[b].second);
+        });
+        std::vector<std::size_t> left_group(n), right_group(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            left_group[by_left[i]] = (i > 0 && !cmp_left(candidates[by_left[i - 1]].first, candidates[by_left[i]].first))
+                                     ? left_group[by_left[i - 1]] : i;
+            right_group[by_right[i]] = (i > 0 && !cmp_right(candidates[by_right[i - 1]].second, candidates[by_right[i]].second))
+                                       ? right_group[by_right[i - 1]] : i;
+        }
+        std::vector<bool> left_taken(n), right_taken(n);
+        std::vector<std::pair<Left, Right>> res;
+        for (std::size_t i = 0; i < n; ++i) {
+            if (!left_taken[left_group[i]] && !right_taken[right_group[i]]) {
+                left_taken[left_group[i]] = right_taken[right_group[i]] = true;
+                res.push_back(std::move(candidates[i]));
+            }
+        }
+        return res;
+    }
+
+    // Merges sorted keys of a side with added ones (of order, by the same comparator) skipping removed
+    // positions, new positions of old and added keys are written to moved and placed.
+    template<typename Key, typename Compare, typename Get>
+    static std::vector<Key> merge_side_(std::vector<Key> const &keys, std::vector<bool> const &removed,
+                                        std::vector<std::size_t> const &order, Get get, Compare const &cmp,
+                                        std::vector<std::size_t> &moved, std::vector<std::size_t> &placed) {
+        std::vector<Key> res;
+        res.reserve(keys.size() + order.size());
+        moved.assign(keys.size(), npos);
+        placed.assign(order.size(), npos);
+        std::size_t i = 0, j = 0;
+        while (i < keys.size() || j < order.size()) {
+            if (i < keys.size() && !removed.empty() && removed[i]) {
+                ++i;
+            } else if (j == order.size() || (i < keys.size() && cmp(keys[i], get(order[j])))) {
+                moved[i] = res.size();
+                res.push_back(keys[i++]);
+            } else {
+                placed[order[j]] = res.size();
+                res.push_back(get(order[j++]));
+            }
+        }
+        return res;
+    }
+
+    // Rebuilds both sides in linear time (after sorting added): added pairs have to be absent and unique,
+    // removed marks left positions to drop (empty means none). Gives the strong exception guarantee.
+    void rebuild_(std::vector<std::pair<Left, Right>> const &added, std::vector<bool> const &removed_left) {
+        std::size_t n = size();
+        std::size_t m = added.size();
+        if (n + m > std::numeric_limits<index_t>::max()) {
+            throw std::length_error("flat_bimap is too big");
+        }
+        std::vector<bool> removed_right;
+        if (!removed_left.empty()) {
+            removed_right.resize(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                removed_right[storage.left_to_right[i]] = removed_left[i];
+            }
+        }
+
+        std::vector<std::size_t> by_left(m), by_right(m);
+        for (std::size_t k = 0; k < m; ++k) {
+            by_left[k] = by_right[k] = k;
+        }
+        std::sort(by_left.begin(), by_left.end(), [&](std::size_t a, std::size_t b) {
+            return cmp_left(added[a].first, added[b].first);
+        });
+        std::sort(by_right.begin(), by_right.end(), [&](std::size_t a, std::size_t b) {
+            return cmp_right(added[a].second, added[b].second);
+        });
+
+        std::vector<std::size_t> left_moved, left_placed, right_moved, right_placed;
+        storage_t next;
+        next.lefts = merge_side_(storage.lefts, removed_left, by_left,
+                                 [&](std::size_t k) -> Left const & { return added[k].first; },
+                                 cmp_left, left_moved, left_placed);
+        next.rights = merge_side_(storage.rights, removed_right, by_right,
+                                  [&](std::size_t k) -> Right const & { return added[k].second; },
+                                  cmp_right, right_moved, right_placed);
+        next.left_to_right.resize(next.lefts.size());
+        next.right_to_left.resize(next.rights.size());
+        for (std::size_t i = 0; i < n; ++i) {
+            if (left_moved[i] != npos) {
+                std::size_t r = right_moved[storage.left_to_right[i]];
+                next.left_to_right[left_moved[i]] = static_cast<index_t>(r);
+                next.right_to_left[r] = static_cast<index_t>(left_moved[i]);
+            }
+        }
+        for (std::size_t k = 0; k < m; ++k) {
+            next.left_to_right[left_placed[k]] = static_cast<index_t>(right_placed[k]);
+            next.right_to_left[right_placed[k]] = static_cast<index_t>(left_placed[k]);
+        }
+        storage = std::move(next);
+    }
+
+private:
+    storage_t storage;
+    CompareLeft cmp_left;
+    CompareRight cmp_right;
+};
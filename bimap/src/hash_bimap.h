@@ -0,0 +1,639 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <functional>
+#include <stdexcept>
+
+namespace intrusive {
+    template<typename Left, typename Right>
+    struct hash_element;
+}
+
+template<typename Left, typename Right, typename HashLeft = std::hash<Left>, typename HashRight = std::hash<Right>,
+        typename EqualLeft = std::equal_to<Left>, typename EqualRight = std::equal_to<Right>,
+        typename Allocator = intrusive::slab_allocator<intrusive::hash_element<Left, Right>>>
+struct hash_bimap;
+
+namespace intrusive {
+    // Links of one hash index: the next node of the bucket chain and the mixed hash of the key.
+    struct hash_node_base {
+        hash_node_base *next;
+        std::size_t hash;
+    };
+
+    template<typename Tag>
+    struct hash_node : hash_node_base {
+        hash_node() noexcept
+                : hash_node_base{nullptr, 0} {}
+
+        hash_node(hash_node const &) = delete;
+
+        hash_node &operator=(hash_node const &) = delete;
+    };
+
+    template<typename T, typename Tag>
+    hash_node_base &to_hash_node(T &obj) noexcept {
+        return static_cast<hash_node<Tag> &>(obj);
+    }
+
+    template<typename T, typename Tag>
+    hash_node_base const &to_hash_node(T const &obj) noexcept {
+        return static_cast<hash_node<Tag> const &>(obj);
+    }
+
+    template<typename T, typename Tag>
+    T &from_hash_node(hash_node_base &base) noexcept {
+        return static_cast<T &>(static_cast<hash_node<Tag> &>(base));
+    }
+
+    template<typename T, typename Tag>
+    T const &from_hash_node(hash_node_base const &base) noexcept {
+        return static_cast<T const &>(static_cast<hash_node<Tag> const &>(base));
+    }
+
+    // Pair of keys which is linked into the hash indices of both sides.
+    template<typename Left, typename Right>
+    struct hash_element : hash_node<tag_left>, hash_node<tag_right> {
+        template<typename L, typename R>
+        hash_element(L &&left, R &&right)
+                : left(std::forward<L>(left)), right(std::forward<R>(right)) {}
+
+        Left const &get_left() const noexcept {
+            return left;
+        }
+
+        Right const &get_right() const noexcept {
+            return right;
+        }
+
+        // Key of the index of Tag
+        template<typename Tag>
+        decltype(auto) get() const noexcept {
+            if constexpr (std::is_same_v<Tag, tag_left>) {
+                return get_left();
+            } else {
+                return get_right();
+            }
+        }
+
+    private:
+        Left left;
+        Right right;
+    };
+
+    // Buckets of one side, the number of buckets is zero or a power of two.
+    // The opposite index is kept for flip() of the end.
+    struct hash_index_base {
+        std::size_t bucket_of(std::size_t hash) const noexcept {
+            return hash & (buckets.size() - 1);
+        }
+
+        std::vector<hash_node_base *> buckets;
+        hash_index_base *opposite = nullptr;
+    };
+
+    template<typename Key, typename Value, typename Tag>
+    struct hash_iterator {
+        using iterator = hash_iterator<Key, Value, Tag>;
+
+        using element_t = std::conditional_t<std::is_same_v<Tag, tag_left>, hash_element<Key, Value>, hash_element<Value, Key>>;
+
+        using opposite_tag_t = std::conditional_t<std::is_same_v<Tag, tag_left>, tag_right, tag_left>;
+        using opposite_iterator = hash_iterator<Value, Key, opposite_tag_t>;
+
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Key;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Key const *;
+        using reference = Key const &;
+
+        hash_iterator()
+                : index(nullptr), current(nullptr), bucket(0) {}
+
+        // Dereferencing end() or invalid iterator is undefined.
+        Key const &operator*() const {
+            return from_hash_node<element_t, Tag>(*current).template get<Tag>();
+        }
+
+        Key const *operator->() const {
+            return &**this;
+        }
+
+        // Goes along the chain, then to the next non-empty bucket.
+        // Increment of end() is undefined.
+        iterator &operator++() {
+            current = current->next;
+            if (current == nullptr) {
+                ++bucket;
+                skip_empty_();
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        // Iterator of the other key of the same pair, end().flip() is the opposite end().
+        opposite_iterator flip() const {
+            hash_index_base const *other = index->opposite;
+            if (current == nullptr) {
+                return opposite_iterator(other, nullptr, other->buckets.size());
+            }
+            hash_node_base &n = to_hash_node<element_t, opposite_tag_t>(from_hash_node<element_t, Tag>(*current));
+            return opposite_iterator(other, &n, other->bucket_of(n.hash));
+        }
+
+        friend bool operator==(iterator const &a, iterator const &b) {
+            return a.current == b.current;
+        }
+
+        friend bool operator!=(iterator const &a, iterator const &b) {
+            return a.current != b.current;
+        }
+
+    private:
+        hash_iterator(hash_index_base const *index, hash_node_base *current, std::size_t bucket)
+                : index(index), current(current), bucket(bucket) {}
+
+        void skip_empty_() noexcept {
+            while (bucket < index->buckets.size() && (current = index->buckets[bucket]) == nullptr) {
+                ++bucket;
+            }
+        }
+
+        hash_node_base *get_data() const noexcept {
+            return current;
+        }
+
+    private:
+        hash_index_base const *index;
+        hash_node_base *current;
+        std::size_t bucket;
+
+        template<typename Key1, typename Value1, typename Hash1, typename KeyEqual1, typename Tag1>
+        friend
+        struct hash_index;
+
+        template<typename Key1, typename Value1, typename Tag1>
+        friend
+        struct hash_iterator;
+
+        template<typename Left1, typename Right1, typename HashLeft1, typename HashRight1,
+                typename EqualLeft1, typename EqualRight1, typename Allocator1>
+        friend
+        struct ::hash_bimap;
+    };
+
+    // Intrusive chained hash index of one side, nodes are owned by hash_bimap.
+    template<typename Key, typename Value, typename Hash, typename KeyEqual, typename Tag>
+    struct hash_index : hash_index_base {
+        using iterator = hash_iterator<Key, Value, Tag>;
+        using element_t = typename iterator::element_t;
+
+        explicit hash_index(Hash hasher = Hash(), KeyEqual key_equal = KeyEqual())
+                : hasher(std::move(hasher)), key_equal(std::move(key_equal)) {}
+
+        hash_index(hash_index &&other) noexcept
+                : hash_index_base{std::move(other.buckets), nullptr}, hasher(other.hasher),
+                  key_equal(other.key_equal) {
+            other.buckets.clear();
+        }
+
+        std::size_t hash_of(Key const &key) const {
+            // Bucket indices are the low bits of the hash, so weak hashes (like std::hash<int>) are mixed first
+            return mix_hash(hasher(key));
+        }
+
+        bool equals(Key const &a, Key const &b) const {
+            return key_equal(a, b);
+        }
+
+        // Returns node with the key or nullptr, hash has to be hash_of(key).
+        hash_node_base *find_node(Key const &key, std::size_t hash) const {
+            if (buckets.empty()) {
+                return nullptr;
+            }
+            for (hash_node_base *n = buckets[bucket_of(hash)]; n != nullptr; n = n->next) {
+                if (n->hash == hash && key_equal(from_hash_node<element_t, Tag>(*n).template get<Tag>(), key)) {
+                    return n;
+                }
+            }
+            return nullptr;
+        }
+
+        iterator find(Key const &key) const {
+            std::size_t hash = hash_of(key);
+            hash_node_base *n = find_node(key, hash);
+            return n == nullptr ? end() : iterator(this, n, bucket_of(hash));
+        }
+
+        Value const &at(Key const &key) const {
+            iterator it = find(key);
+            if (it == end()) {
+                throw std::out_of_range("no such element in hash_bimap");
+            }
+            return *it.flip();
+        }
+
+        iterator to_iterator(hash_node_base *n) const noexcept {
+            return iterator(this, n, bucket_of(n->hash));
+        }
+
+        iterator begin() const {
+            iterator it(this, nullptr, 0);
+            it.skip_empty_();
+            return it;
+        }
+
+        iterator end() const {
+            return iterator(this, nullptr, buckets.size());
+        }
+
+        // There has to be at least one bucket, n->hash has to be set.
+        void link(hash_node_base *n) noexcept {
+            hash_node_base *&head = buckets[bucket_of(n->hash)];
+            n->next = head;
+            head = n;
+        }
+
+        void unlink(hash_node_base *n) noexcept {
+            hash_node_base **slot = &buckets[bucket_of(n->hash)];
+            while (*slot != n) {
+                slot = &(*slot)->next;
+            }
+            *slot = n->next;
+            n->next = nullptr;
+        }
+
+        // Moves all nodes to count buckets, count has to be a power of two.
+        // Hashes are stored in nodes, so keys are not hashed again.
+        void rehash(std::size_t count) {
+            std::vector<hash_node_base *> old(count, nullptr);
+            old.swap(buckets);
+            for (hash_node_base *head : old) {
+                while (head != nullptr) {
+                    hash_node_base *next = head->next;
+                    link(head);
+                    head = next;
+                }
+            }
+        }
+
+        Hash const &hash_function() const noexcept {
+            return hasher;
+        }
+
+        KeyEqual const &key_eq() const noexcept {
+            return key_equal;
+        }
+
+        void swap(hash_index &other) noexcept {
+            buckets.swap(other.buckets);
+            std::swap(hasher, other.hasher);
+            std::swap(key_equal, other.key_equal);
+        }
+
+    private:
+        Hash hasher;
+        KeyEqual key_equal;
+    };
+}
+
+// Bimap with hash indices instead of trees: expected O(1) find, at, insert and erase, no ordered traversal.
+// Each pair is a single node linked into the chains of both sides, left and right iterators are flipped like in bimap.
+// Unlike bimap, iterators are forward only and are invalidated by rehashing (insert can rehash), swap and move.
+template<typename Left, typename Right, typename HashLeft, typename HashRight, typename EqualLeft, typename EqualRight,
+        typename Allocator>
+struct hash_bimap {
+    using tag_left = intrusive::tag_left;
+    using tag_right = intrusive::tag_right;
+    using node_t = intrusive::hash_element<Left, Right>;
+    using node_base = intrusive::hash_node_base;
+    using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<node_t>;
+    using allocator_traits = std::allocator_traits<allocator_type>;
+
+    using left_iterator = intrusive::hash_iterator<Left, Right, tag_left>;
+    using right_iterator = intrusive::hash_iterator<Right, Left, tag_right>;
+
+    // Creates empty hash_bimap, no buckets are allocated until the first insert.
+    // The default allocator gets its memory by the first insert too.
+    hash_bimap(HashLeft hash_left = HashLeft(), HashRight hash_right = HashRight(),
+               EqualLeft equal_left = EqualLeft(), EqualRight equal_right = EqualRight())
+            : hash_bimap(std::move(hash_left), std::move(hash_right), std::move(equal_left), std::move(equal_right),
+                         intrusive::unallocated<allocator_type>(), 0) {}
+
+    hash_bimap(HashLeft hash_left, HashRight hash_right, EqualLeft equal_left, EqualRight equal_right,
+               Allocator const &alloc)
+            : hash_bimap(std::move(hash_left), std::move(hash_right), std::move(equal_left), std::move(equal_right),
+                         allocator_type(alloc), 0) {}
+
+    // Creates hash_bimap from range of pairs, the result is the same as after inserting them one by one.
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    hash_bimap(InputIt first, InputIt last, HashLeft hash_left = HashLeft(), HashRight hash_right = HashRight(),
+               EqualLeft equal_left = EqualLeft(), EqualRight equal_right = EqualRight(),
+               Allocator const &alloc = Allocator())
+            : hash_bimap(std::move(hash_left), std::move(hash_right), std::move(equal_left), std::move(equal_right),
+                         alloc) {
+        if constexpr (std::is_base_of_v<std::forward_iterator_tag,
+                typename std::iterator_traits<InputIt>::iterator_category>) {
+            reserve(static_cast<std::size_t>(std::distance(first, last)));
+        }
+        for (; first != last; ++first) {
+            insert(first->first, first->second);
+        }
+    }
+
+    // Stored hashes are reused, so keys are not hashed again.
+    hash_bimap(hash_bimap const &other)
+            : hash_bimap(other.index_left.hash_function(), other.index_right.hash_function(),
+                         other.index_left.key_eq(), other.index_right.key_eq(),
+                         allocator_traits::select_on_container_copy_construction(other.alloc), 0) {
+        reserve(other.sz);
+        for (node_base *head : other.index_left.buckets) {
+            for (node_base *n = head; n != nullptr; n = n->next) {
+                node_t const &el = intrusive::from_hash_node<node_t, tag_left>(*n);
+                node_t *nd = new_node_(el.get_left(), el.get_right());
+                link_(nd, n->hash, intrusive::to_hash_node<node_t, tag_right>(el).hash);
+            }
+        }
+    }
+
+    // The allocator is moved like in bimap, so the two do not share a slab pool.
+    hash_bimap(hash_bimap &&other) noexcept
+            : index_left(std::move(other.index_left)), index_right(std::move(other.index_right)),
+              alloc(std::move(other.alloc)), sz(other.sz) {
+        link_ends_();
+        other.sz = 0;
+    }
+
+    hash_bimap &operator=(hash_bimap const &other) {
+        if (this != &other) {
+            hash_bimap tmp(other);
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    hash_bimap &operator=(hash_bimap &&other) noexcept {
+        if (this != &other) {
+            hash_bimap tmp(std::move(other));
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    ~hash_bimap() {
+        clear_();
+    }
+
+    // Inserting pair (left, right) returns left iterator.
+    // If left or right is already in hash_bimap, there is no insertion and returns end_left().
+    template<typename L = Left, typename R = Right>
+    left_iterator insert(L &&left, R &&right) {
+        std::size_t left_hash = index_left.hash_of(left);
+        if (index_left.find_node(left, left_hash) != nullptr) {
+            return end_left();
+        }
+        std::size_t right_hash = index_right.hash_of(right);
+        if (index_right.find_node(right, right_hash) != nullptr) {
+            return end_left();
+        }
+        if (sz + 1 > bucket_count()) {
+            reserve(sz + 1);
+        }
+        node_t *nd = new_node_(std::forward<L>(left), std::forward<R>(right));
+        return index_left.to_iterator(link_(nd, left_hash, right_hash));
+    }
+
+    // Removes an element and its corresponding paired, returns the iterator after it.
+    // erase of invalid iterator or end() is undefined.
+    left_iterator erase_left(left_iterator it) {
+        left_iterator res = std::next(it);
+        erase_node_(&intrusive::from_hash_node<node_t, tag_left>(*it.get_data()));
+        return res;
+    }
+
+    // Returns whether the pair was deleted or not.
+    bool erase_left(Left const &left) {
+        left_iterator it = find_left(left);
+        if (it == end_left()) {
+            return false;
+        }
+        erase_left(it);
+        return true;
+    }
+
+    right_iterator erase_right(right_iterator it) {
+        right_iterator res = std::next(it);
+        erase_node_(&intrusive::from_hash_node<node_t, tag_right>(*it.get_data()));
+        return res;
+    }
+
+    bool erase_right(Right const &right) {
+        right_iterator it = find_right(right);
+        if (it == end_right()) {
+            return false;
+        }
+        erase_right(it);
+        return true;
+    }
+
+    // Returns element's iterator or end() if the element wasn't found.
+    left_iterator find_left(Left const &left) const {
+        return index_left.find(left);
+    }
+
+    right_iterator find_right(Right const &right) const {
+        return index_right.find(right);
+    }
+
+    // Returns an opposite element by element.
+    // If there is no element - throws std::out_of_range.
+    Right const &at_left(Left const &key) const {
+        return index_left.at(key);
+    }
+
+    Left const &at_right(Right const &key) const {
+        return index_right.at(key);
+    }
+
+    // Same as in bimap: a missing key gets the default opposite element,
+    // a pair which already has the default element is removed first.
+    template<typename T = Right, std::enable_if_t<std::is_default_constructible_v<T>, bool> = true>
+    Right const &at_left_or_default(Left const &key) {
+        left_iterator left_it = find_left(key);
+        if (left_it != end_left()) {
+            return *left_it.flip();
+        }
+        Right r{};
+        erase_right(r);
+        return *insert(key, std::move(r)).flip();
+    }
+
+    template<typename T = Left, std::enable_if_t<std::is_default_constructible_v<T>, bool> = true>
+    Left const &at_right_or_default(Right const &key) {
+        right_iterator right_it = find_right(key);
+        if (right_it != end_right()) {
+            return *right_it.flip();
+        }
+        Left l{};
+        erase_left(l);
+        return *insert(std::move(l), key);
+    }
+
+    // Iteration order is unspecified and is not the same for both sides.
+    left_iterator begin_left() const {
+        return index_left.begin();
+    }
+
+    left_iterator end_left() const {
+        return index_left.end();
+    }
+
+    right_iterator begin_right() const {
+        return index_right.begin();
+    }
+
+    right_iterator end_right() const {
+        return index_right.end();
+    }
+
+    bool empty() const {
+        return sz == 0;
+    }
+
+    std::size_t size() const {
+        return sz;
+    }
+
+    std::size_t bucket_count() const {
+        return std::min(index_left.buckets.size(), index_right.buckets.size());
+    }
+
+    // Rehashes both sides so that n pairs fit without exceeding the load factor of 1.
+    void reserve(std::size_t n) {
+        std::size_t count = std::max<std::size_t>(bucket_count(), min_bucket_count);
+        while (count < n) {
+            count *= 2;
+        }
+        if (index_left.buckets.size() != count) {
+            index_left.rehash(count);
+        }
+        if (index_right.buckets.size() != count) {
+            index_right.rehash(count);
+        }
+    }
+
+    // The allocator sharing memory with this hash_bimap, see bimap::get_allocator.
+    Allocator get_allocator() const {
+        if constexpr (intrusive::has_share<allocator_type>::value) {
+            return Allocator(alloc.share());
+        } else {
+            return Allocator(alloc);
+        }
+    }
+
+    void swap(hash_bimap &other) noexcept {
+        index_left.swap(other.index_left);
+        index_right.swap(other.index_right);
+        std::swap(alloc, other.alloc);
+        std::swap(sz, other.sz);
+    }
+
+    // Pairs are compared regardless of their order.
+    friend bool operator==(hash_bimap const &a, hash_bimap const &b) {
+        if (a.sz != b.sz) {
+            return false;
+        }
+        for (left_iterator it = a.begin_left(); it != a.end_left(); ++it) {
+            left_iterator other = b.find_left(*it);
+            if (other == b.end_left() || !a.index_right.equals(*it.flip(), *other.flip())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend bool operator!=(hash_bimap const &a, hash_bimap const &b) {
+        return !(a == b);
+    }
+
+private:
+    static constexpr std::size_t min_bucket_count = 16;
+
+    hash_bimap(HashLeft hash_left, HashRight hash_right, EqualLeft equal_left, EqualRight equal_right,
+               allocator_type &&alloc, std::size_t sz)
+            : index_left(std::move(hash_left), std::move(equal_left)),
+              index_right(std::move(hash_right), std::move(equal_right)), alloc(std::move(alloc)), sz(sz) {
+        link_ends_();
+    }
+
+    // end_left().flip() == end_right() and vice versa
+    void link_ends_() noexcept {
+        index_left.opposite = &index_right;
+        index_right.opposite = &index_left;
+    }
+
+    // Both sides have to have enough buckets.
+    node_base *link_(node_t *nd, std::size_t left_hash, std::size_t right_hash) noexcept {
+        node_base *l = &intrusive::to_hash_node<node_t, tag_left>(*nd);
+        node_base *r = &intrusive::to_hash_node<node_t, tag_right>(*nd);
+        l->hash = left_hash;
+        r->hash = right_hash;
+        index_left.link(l);
+        index_right.link(r);
+        ++sz;
+        return l;
+    }
+
+    void erase_node_(node_t *nd) noexcept {
+        index_left.unlink(&intrusive::to_hash_node<node_t, tag_left>(*nd));
+        index_right.unlink(&intrusive::to_hash_node<node_t, tag_right>(*nd));
+        delete_node_(nd);
+        --sz;
+    }
+
+    template<typename... Args>
+    node_t *new_node_(Args &&... args) {
+        node_t *nd = allocator_traits::allocate(alloc, 1);
+        try {
+            allocator_traits::construct(alloc, nd, std::forward<Args>(args)...);
+        } catch (...) {
+            allocator_traits::deallocate(alloc, nd, 1);
+            throw;
+        }
+        return nd;
+    }
+
+    void delete_node_(node_t *nd) noexcept {
+        allocator_traits::destroy(alloc, nd);
+        allocator_traits::deallocate(alloc, nd, 1);
+    }
+
+    // The allocator is asked to free all its memory at once if it can.
+    void clear_() noexcept {
+        if constexpr (intrusive::has_release<allocator_type>::value &&
+                      std::is_trivially_destructible_v<Left> && std::is_trivially_destructible_v<Right>) {
+            if (alloc.release()) {
+                return;
+            }
+        }
+        for (node_base *head : index_left.buckets) {
+            while (head != nullptr) {
+                node_base *next = head->next;
+                delete_node_(&intrusive::from_hash_node<node_t, tag_left>(*head));
+                head = next;
+            }
+        }
+    }
+
+private:
+    intrusive::hash_index<Left, Right, HashLeft, EqualLeft, tag_left> index_left;
+    intrusive::hash_index<Right, Left, HashRight, EqualRight, tag_right> index_right;
+    allocator_type alloc;
+    std::size_t sz;
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "bimap.h"
+#include "flat_bimap.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace intrusive {
+    // Array which is owned by someone else
+    template<typename T>
+    struct array_view {
+        T const *data = nullptr;
+        std::size_t n = 0;
+
+        std::size_t size() const noexcept {
+            return n;
+        }
+
+        T const &operator[](std::size_t i) const noexcept {
+            return data[i];
+        }
+    };
+
+    // Sections of a mapped image, the same interface as flat_storage has.
+    template<typename Left, typename Right>
+    struct mapped_storage {
+        using index_t = std::uint32_t;
+
+        array_view<Left> lefts;
+        array_view<Right> rights;
+        array_view<index_t> left_to_right;
+        array_view<index_t> right_to_left;
+
+        template<typename Tag>
+        auto const &keys() const noexcept {
+            if constexpr (std::is_same_v<Tag, tag_left>) {
+                return lefts;
+            } else {
+                return rights;
+            }
+        }
+
+        template<typename Tag>
+        array_view<index_t> const &to_opposite() const noexcept {
+            if constexpr (std::is_same_v<Tag, tag_left>) {
+                return left_to_right;
+            } else {
+                return right_to_left;
+            }
+        }
+    };
+}
+
+// Read-only bimap over a file written by bimap::save, the comparators have to be the same.
+// The file is memory-mapped and lookups are binary searches right in the mapped sections, so the key
+// sections are read from the disk only where lookups touch them.
+// Opening takes O(n): the index sections are checked to be inverse permutations, so flip never leaves
+// the mapping. The order of keys is trusted.
+// Moving invalidates iterators.
+template<typename Left, typename Right, typename CompareLeft, typename CompareRight>
+struct mapped_bimap {
+    static_assert(std::is_trivially_copyable_v<Left> && std::is_trivially_copyable_v<Right>,
+                  "images are written for trivially copyable keys only");
+    static_assert(alignof(Left) <= intrusive::image_layout::alignment &&
+                  alignof(Right) <= intrusive::image_layout::alignment, "over-aligned keys are not supported");
+
+    using tag_left = intrusive::tag_left;
+    using tag_right = intrusive::tag_right;
+    using storage_t = intrusive::mapped_storage<Left, Right>;
+
+    using left_iterator = intrusive::flat_iterator<Left, Right, tag_left, storage_t>;
+    using right_iterator = intrusive::flat_iterator<Right, Left, tag_right, storage_t>;
+
+    // Maps the file, throws std::system_error if it can not be opened and std::runtime_error if it is not an image
+    // or its permutations are broken.
+    explicit mapped_bimap(std::string const &path, CompareLeft compare_left = CompareLeft(),
+                          CompareRight compare_right = CompareRight())
+            : cmp_left(std::move(compare_left)), cmp_right(std::move(compare_right)) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "can not open " + path);
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "can not stat " + path);
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length < sizeof(intrusive::image_header)) {
+            ::close(fd);
+            throw std::runtime_error("bimap image is truncated");
+        }
+        void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error = errno;
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            throw std::system_error(error, std::generic_category(), "can not map " + path);
+        }
+        image = static_cast<char const *>(p);
+
+        intrusive::image_header header;
+        std::memcpy(&header, image, sizeof(header));
+        if (!header.valid(sizeof(Left), sizeof(Right))) {
+            unmap_();
+            throw std::runtime_error("bimap image is malformed");
+        }
+        std::size_t n = header.count;
+        intrusive::image_layout layout(n, sizeof(Left), sizeof(Right));
+        if (length < layout.total) {
+            unmap_();
+            throw std::runtime_error("bimap image is truncated");
+        }
+        storage.lefts = {reinterpret_cast<Left const *>(image + layout.lefts), n};
+        storage.rights = {reinterpret_cast<Right const *>(image + layout.rights), n};
+        storage.left_to_right = {reinterpret_cast<std::uint32_t const *>(image + layout.left_to_right), n};
+        storage.right_to_left = {reinterpret_cast<std::uint32_t const *>(image + layout.right_to_left), n};
+        if (!intrusive::valid_permutations(storage.left_to_right.data, storage.right_to_left.data, n)) {
+            unmap_();
+            throw std::runtime_error("bimap image is malformed");
+        }
+    }
+
+    mapped_bimap(mapped_bimap const &) = delete;
+
+    mapped_bimap &operator=(mapped_bimap const &) = delete;
+
+    mapped_bimap(mapped_bimap &&other) noexcept
+            : storage(other.storage), cmp_left(other.cmp_left), cmp_right(other.cmp_right), image(other.image),
+              length(other.length) {
+        other.storage = storage_t();
+        other.image = nullptr;
+        other.length = 0;
+    }
+
+    mapped_bimap &operator=(mapped_bimap &&other) noexcept {
+        if (this != &other) {
+            mapped_bimap tmp(std::move(other));
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    ~mapped_bimap() {
+        unmap_();
+    }
+
+    // Returns element's iterator or end() if the element wasn't found.
+    left_iterator find_left(Left const &left) const {
+        return find_<tag_left>(left, cmp_left);
+    }
+
+    right_iterator find_right(Right const &right) const {
+        return find_<tag_right>(right, cmp_right);
+    }
+
+    // Returns an opposite element by element.
+    // If there is no element - throws std::out_of_range.
+    Right const &at_left(Left const &key) const {
+        left_iterator it = find_left(key);
+        if (it == end_left()) {
+            throw std::out_of_range("no such element in mapped_bimap");
+        }
+        return *it.flip();
+    }
+
+    Left const &at_right(Right const &key) const {
+        right_iterator it = find_right(key);
+        if (it == end_right()) {
+            throw std::out_of_range("no such element in mapped_bimap");
+        }
+        return *it.flip();
+    }
+
+    // See std::lower_bound, std::upper_bound.
+    left_iterator lower_bound_left(Left const &left) const {
+        return left_iterator(&storage, lower_bound_(storage.lefts, left, cmp_left));
+    }
+
+    left_iterator upper_bound_left(Left const &left) const {
+        return left_iterator(&storage, upper_bound_(storage.lefts, left, cmp_left));
+    }
+
+    right_iterator lower_bound_right(Right const &right) const {
+        return right_iterator(&storage, lower_bound_(storage.rights, right, cmp_right));
+    }
+
+    right_iterator upper_bound_right(Right const &right) const {
+        return right_iterator(&storage, upper_bound_(storage.rights, right, cmp_right));
+    }
+
+    left_iterator begin_left() const {
+        return left_iterator(&storage, 0);
+    }
+
+    left_iterator end_left() const {
+        return left_iterator(&storage, size());
+    }
+
+    right_iterator begin_right() const {
+        return right_iterator(&storage, 0);
+    }
+
+    right_iterator end_right() const {
+        return right_iterator(&storage, size());
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    std::size_t size() const {
+        return storage.lefts.size();
+    }
+
+    void swap(mapped_bimap &other) noexcept {
+        std::swap(storage, other.storage);
+        std::swap(cmp_left, other.cmp_left);
+        std::swap(cmp_right, other.cmp_right);
+        std::swap(image, other.image);
+        std::swap(length, other.length);
+    }
+
+private:
+    template<typename Tag, typename Key, typename Compare>
+    auto find_(Key const &key, Compare const &cmp) const {
+        auto const &keys = storage.template keys<Tag>();
+        std::size_t pos = lower_bound_(keys, key, cmp);
+        if (pos != keys.size() && cmp(key, keys[pos])) {
+            pos = keys.size();
+        }
+        return intrusive::flat_iterator<Key, std::conditional_t<std::is_same_v<Tag, tag_left>, Right, Left>, Tag,
+                storage_t>(&storage, pos);
+    }
+
+    template<typename Key, typename Compare>
+    static std::size_t lower_bound_(intrusive::array_view<Key> const &keys, Key const &key, Compare const &cmp) {
+        return intrusive::branchless_lower_bound(keys.data, keys.size(), key, cmp);
+    }
+
+    template<typename Key, typename Compare>
+    static std::size_t upper_bound_(intrusive::array_view<Key> const &keys, Key const &key, Compare const &cmp) {
+        return intrusive::branchless_lower_bound(keys.data, keys.size(), key,
+                                                 [&cmp](Key const &a, Key const &b) { return !cmp(b, a); });
+    }
+
+    void unmap_() noexcept {
+        if (image != nullptr) {
+            ::munmap(const_cast<char *>(image), length);
+            image = nullptr;
+        }
+    }
+
+private:
+    storage_t storage;
+    CompareLeft cmp_left;
+    CompareRight cmp_right;
+    char const *image = nullptr;
+    std::size_t length = 0;
+};
@@ -0,0 +1,422 @@
+#pragma once
+
+#include "bimap.h"
+#include "persistent_treap.h"
+
+#include <atomic>
+#include <stdexcept>
+
+namespace intrusive {
+    // Treap node shared by versions, it is freed when the last version (or parent) referencing it is gone.
+    template<typename Key, typename Value>
+    struct counted_node {
+        using key_type = Key;
+        using value_type = Value;
+
+        template<typename K, typename V>
+        counted_node(K &&key, V &&value, int priority, counted_node const *left, counted_node const *right)
+                : key(std::forward<K>(key)), value(std::forward<V>(value)), priority(priority), left(left),
+                  right(right) {}
+
+        Key key;
+        Value value;
+        int priority;
+        counted_node const *left;
+        counted_node const *right;
+        mutable std::atomic<std::size_t> refs{1};
+    };
+
+    // Owner of path_copying for reference counted nodes.
+    // Shared subtrees get one more reference, new nodes own references to their children.
+    // If the update fails, new nodes are freed and shared references are returned.
+    template<typename Node, typename Alloc>
+    struct counting_owner {
+        using traits = std::allocator_traits<Alloc>;
+
+        explicit counting_owner(Alloc &alloc) noexcept
+                : alloc(alloc) {}
+
+        counting_owner(counting_owner const &) = delete;
+
+        counting_owner &operator=(counting_owner const &) = delete;
+
+        ~counting_owner() {
+            for (Node const *n : shared) {
+                n->refs.fetch_sub(1, std::memory_order_relaxed);
+            }
+            for (Node *n : created) {
+                traits::destroy(alloc, n);
+                traits::deallocate(alloc, n, 1);
+            }
+        }
+
+        Node const *share(Node const *n) {
+            if (n != nullptr) {
+                shared.push_back(n);
+                n->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+            return n;
+        }
+
+        Node const *copy(Node const &n, Node const *left, Node const *right) {
+            return create_(n.key, n.value, n.priority, left, right);
+        }
+
+        Node const *copy(Node &&n, Node const *left, Node const *right) {
+            return create_(std::move(n.key), std::move(n.value), n.priority, left, right);
+        }
+
+        void replaced(Node const *) noexcept {}
+
+        // The new tree keeps all references.
+        void commit() noexcept {
+            shared.clear();
+            created.clear();
+        }
+
+        // Drops a reference to t, freeing nodes which are not referenced anymore.
+        // Recursion goes to left children only, so its depth is bounded by the height of the tree.
+        static void release(Node const *t, Alloc &alloc) noexcept {
+            while (t != nullptr && t->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                release(t->left, alloc);
+                Node const *right = t->right;
+                traits::destroy(alloc, const_cast<Node *>(t));
+                traits::deallocate(alloc, const_cast<Node *>(t), 1);
+                t = right;
+            }
+        }
+
+    private:
+        template<typename K, typename V>
+        Node const *create_(K &&key, V &&value, int priority, Node const *left, Node const *right) {
+            created.reserve(created.size() + 1);
+            Node *res = traits::allocate(alloc, 1);
+            try {
+                traits::construct(alloc, res, std::forward<K>(key), std::forward<V>(value), priority, left, right);
+            } catch (...) {
+                traits::deallocate(alloc, res, 1);
+                throw;
+            }
+            created.push_back(res);
+            return res;
+        }
+
+        Alloc &alloc;
+        std::vector<Node const *> shared;
+        std::vector<Node *> created;
+    };
+
+    // In-order iterator of a tree without parent links.
+    // The path keeps the current node and its ancestors which are still to be visited.
+    template<typename Node>
+    struct persistent_iterator {
+        using iterator = persistent_iterator<Node>;
+        using key_t = typename Node::key_type;
+        using value_t = typename Node::value_type;
+
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = key_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = key_t const *;
+        using reference = key_t const &;
+
+        persistent_iterator() = default;
+
+        // Dereferencing end() is undefined.
+        key_t const &operator*() const {
+            return path.back()->key;
+        }
+
+        key_t const *operator->() const {
+            return &path.back()->key;
+        }
+
+        // The element paired with the current one.
+        value_t const &opposite() const {
+            return path.back()->value;
+        }
+
+        iterator &operator++() {
+            Node const *n = path.back()->right;
+            path.pop_back();
+            descend_left_(n);
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        friend bool operator==(iterator const &a, iterator const &b) {
+            return a.current_() == b.current_();
+        }
+
+        friend bool operator!=(iterator const &a, iterator const &b) {
+            return !(a == b);
+        }
+
+        static iterator begin(Node const *root) {
+            iterator res;
+            res.descend_left_(root);
+            return res;
+        }
+
+        template<typename Compare>
+        static iterator find(Node const *t, key_t const &key, Compare const &cmp) {
+            iterator res;
+            while (t != nullptr) {
+                if (cmp(key, t->key)) {
+                    res.path.push_back(t);
+                    t = t->left;
+                } else if (cmp(t->key, key)) {
+                    t = t->right;
+                } else {
+                    res.path.push_back(t);
+                    return res;
+                }
+            }
+            return iterator();
+        }
+
+    private:
+        Node const *current_() const noexcept {
+            return path.empty() ? nullptr : path.back();
+        }
+
+        void descend_left_(Node const *n) {
+            for (; n != nullptr; n = n->left) {
+                path.push_back(n);
+            }
+        }
+
+    private:
+        std::vector<Node const *> path;
+    };
+}
+
+// Immutable bimap, insert and erase return a new version which shares all untouched nodes with the old one.
+// Copying is O(1) and makes a snapshot, an update allocates O(log n) nodes on each side.
+// Nodes are reference counted, so versions may be destroyed in any order. A pair is stored once per side,
+// since path copying of one side cannot share nodes with the other one.
+// Iterators and references are valid while the version they came from is alive.
+// Versions may be updated and destroyed concurrently with the default std::allocator. A slab_allocator is faster,
+// but versions sharing it must not be updated or destroyed concurrently.
+template<typename Left, typename Right, typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>,
+        typename Allocator = std::allocator<intrusive::counted_node<Left, Right>>>
+struct persistent_bimap {
+    using left_node = intrusive::counted_node<Left, Right>;
+    using right_node = intrusive::counted_node<Right, Left>;
+    using left_tree = intrusive::path_copying<left_node, CompareLeft>;
+    using right_tree = intrusive::path_copying<right_node, CompareRight>;
+
+    using left_iterator = intrusive::persistent_iterator<left_node>;
+    using right_iterator = intrusive::persistent_iterator<right_node>;
+
+    // Creates empty bimap
+    persistent_bimap(CompareLeft compare_left = CompareLeft(), CompareRight compare_right = CompareRight(),
+                     Allocator const &alloc = Allocator())
+            : cmp_left(std::move(compare_left)), cmp_right(std::move(compare_right)),
+              left_alloc(alloc), right_alloc(alloc), left_root(nullptr), right_root(nullptr), sz(0) {}
+
+    // Snapshot in O(1): both trees are shared.
+    persistent_bimap(persistent_bimap const &other) noexcept
+            : cmp_left(other.cmp_left), cmp_right(other.cmp_right), left_alloc(other.left_alloc),
+              right_alloc(other.right_alloc), left_root(acquire_(other.left_root)),
+              right_root(acquire_(other.right_root)), sz(other.sz) {}
+
+    persistent_bimap(persistent_bimap &&other) noexcept
+            : cmp_left(other.cmp_left), cmp_right(other.cmp_right), left_alloc(other.left_alloc),
+              right_alloc(other.right_alloc), left_root(other.left_root), right_root(other.right_root),
+              sz(other.sz) {
+        other.left_root = nullptr;
+        other.right_root = nullptr;
+        other.sz = 0;
+    }
+
+    persistent_bimap &operator=(persistent_bimap const &other) noexcept {
+        persistent_bimap tmp(other);
+        swap(tmp);
+        return *this;
+    }
+
+    persistent_bimap &operator=(persistent_bimap &&other) noexcept {
+        persistent_bimap tmp(std::move(other));
+        swap(tmp);
+        return *this;
+    }
+
+    ~persistent_bimap() {
+        left_owner::release(left_root, left_alloc);
+        right_owner::release(right_root, right_alloc);
+    }
+
+    // Returns the version with pair (left, right) inserted.
+    // If left or right is already present, returns the same version.
+    template<typename L = Left, typename R = Right>
+    persistent_bimap insert(L &&left, R &&right) const {
+        if (left_tree::find(left_root, left, cmp_left) != nullptr ||
+            right_tree::find(right_root, right, cmp_right) != nullptr) {
+            return *this;
+        }
+        int priority = intrusive::next_priority();
+        // Each side keeps its own copy of both keys, the protos give them to the new nodes
+        left_node left_proto(left, right, priority, nullptr, nullptr);
+        right_node right_proto(std::forward<R>(right), std::forward<L>(left), priority, nullptr, nullptr);
+        return update_(sz + 1, [&](left_owner &lo, right_owner &ro) {
+            return std::pair{left_tree::insert(left_root, left_proto, cmp_left, lo),
+                             right_tree::insert(right_root, right_proto, cmp_right, ro)};
+        });
+    }
+
+    // Returns the version without the pair of the key.
+    // If there is no such key, returns the same version.
+    persistent_bimap erase_left(Left const &left) const {
+        left_node const *n = left_tree::find(left_root, left, cmp_left);
+        if (n == nullptr) {
+            return *this;
+        }
+        return update_(sz - 1, [&](left_owner &lo, right_owner &ro) {
+            return std::pair{left_tree::erase(left_root, n->key, cmp_left, lo),
+                             right_tree::erase(right_root, n->value, cmp_right, ro)};
+        });
+    }
+
+    persistent_bimap erase_right(Right const &right) const {
+        right_node const *n = right_tree::find(right_root, right, cmp_right);
+        if (n == nullptr) {
+            return *this;
+        }
+        return update_(sz - 1, [&](left_owner &lo, right_owner &ro) {
+            return std::pair{left_tree::erase(left_root, n->value, cmp_left, lo),
+                             right_tree::erase(right_root, n->key, cmp_right, ro)};
+        });
+    }
+
+    // Returns element's iterator or end() if the element wasn't found.
+    left_iterator find_left(Left const &left) const {
+        return left_iterator::find(left_root, left, cmp_left);
+    }
+
+    right_iterator find_right(Right const &right) const {
+        return right_iterator::find(right_root, right, cmp_right);
+    }
+
+    // Returns an opposite element by element.
+    // If there is no element - throws std::out_of_range.
+    Right const &at_left(Left const &key) const {
+        left_node const *n = left_tree::find(left_root, key, cmp_left);
+        if (n == nullptr) {
+            throw std::out_of_range("no such element in persistent_bimap");
+        }
+        return n->value;
+    }
+
+    Left const &at_right(Right const &key) const {
+        right_node const *n = right_tree::find(right_root, key, cmp_right);
+        if (n == nullptr) {
+            throw std::out_of_range("no such element in persistent_bimap");
+        }
+        return n->value;
+    }
+
+    // Iterators go in the order of the comparator, opposite() of an iterator is the paired element.
+    left_iterator begin_left() const {
+        return left_iterator::begin(left_root);
+    }
+
+    left_iterator end_left() const {
+        return left_iterator();
+    }
+
+    right_iterator begin_right() const {
+        return right_iterator::begin(right_root);
+    }
+
+    right_iterator end_right() const {
+        return right_iterator();
+    }
+
+    bool empty() const {
+        return sz == 0;
+    }
+
+    std::size_t size() const {
+        return sz;
+    }
+
+    void swap(persistent_bimap &other) noexcept {
+        std::swap(cmp_left, other.cmp_left);
+        std::swap(cmp_right, other.cmp_right);
+        std::swap(left_alloc, other.left_alloc);
+        std::swap(right_alloc, other.right_alloc);
+        std::swap(left_root, other.left_root);
+        std::swap(right_root, other.right_root);
+        std::swap(sz, other.sz);
+    }
+
+    // Versions sharing the trees are equal without comparing elements.
+    friend bool operator==(persistent_bimap const &a, persistent_bimap const &b) {
+        if (a.sz != b.sz) {
+            return false;
+        }
+        if (a.left_root == b.left_root) {
+            return true;
+        }
+        for (left_iterator it1 = a.begin_left(), it2 = b.begin_left(); it1 != a.end_left(); ++it1, ++it2) {
+            if (a.cmp_left(*it1, *it2) || a.cmp_left(*it2, *it1) ||
+                a.cmp_right(it1.opposite(), it2.opposite()) || a.cmp_right(it2.opposite(), it1.opposite())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend bool operator!=(persistent_bimap const &a, persistent_bimap const &b) {
+        return !(a == b);
+    }
+
+private:
+    using left_alloc_t = typename std::allocator_traits<Allocator>::template rebind_alloc<left_node>;
+    using right_alloc_t = typename std::allocator_traits<Allocator>::template rebind_alloc<right_node>;
+    using left_owner = intrusive::counting_owner<left_node, left_alloc_t>;
+    using right_owner = intrusive::counting_owner<right_node, right_alloc_t>;
+
+    template<typename Node>
+    static Node const *acquire_(Node const *n) noexcept {
+        if (n != nullptr) {
+            n->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    // Builds both roots of the new version with update.
+    template<typename Update>
+    persistent_bimap update_(std::size_t size, Update update) const {
+        persistent_bimap res(cmp_left, cmp_right, left_alloc, right_alloc);
+        left_owner lo(res.left_alloc);
+        right_owner ro(res.right_alloc);
+        auto [left, right] = update(lo, ro);
+        lo.commit();
+        ro.commit();
+        res.left_root = left;
+        res.right_root = right;
+        res.sz = size;
+        return res;
+    }
+
+    persistent_bimap(CompareLeft const &compare_left, CompareRight const &compare_right,
+                     left_alloc_t const &left_alloc, right_alloc_t const &right_alloc)
+            : cmp_left(compare_left), cmp_right(compare_right), left_alloc(left_alloc), right_alloc(right_alloc),
+              left_root(nullptr), right_root(nullptr), sz(0) {}
+
+private:
+    CompareLeft cmp_left;
+    CompareRight cmp_right;
+    left_alloc_t left_alloc;
+    right_alloc_t right_alloc;
+    left_node const *left_root;
+    right_node const *right_root;
+    std::size_t sz;
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <utility>
+
+namespace intrusive {
+    // Treap node which is never changed after it became a part of some version.
+    // Unlike map_element, a pair is stored in a node per side, because path copying of one side
+    // would otherwise have to copy the paired nodes of the other side too.
+    template<typename Key, typename Value>
+    struct persistent_node {
+        using key_type = Key;
+        using value_type = Value;
+
+        template<typename K, typename V>
+        persistent_node(K &&key, V &&value, int priority, persistent_node const *left,
+                        persistent_node const *right)
+                : key(std::forward<K>(key)), value(std::forward<V>(value)), priority(priority), left(left),
+                  right(right) {}
+
+        Key key;
+        Value value;
+        int priority;
+        persistent_node const *left;
+        persistent_node const *right;
+    };
+
+    // Path-copying treap operations: argument trees are never modified, every changed node is copied.
+    // Owner decides how nodes live:
+    //   share(n) returns the old subtree n to be used in the new tree as is,
+    //   copy(n, left, right) returns a new node with the key, value and priority of n and given children,
+    //     the keys are moved out of n when it is an rvalue,
+    //   replaced(n) tells that the old node n is not a part of the new tree.
+    // Children passed to copy and the returned trees are owned by the new tree.
+    template<typename Node, typename Compare>
+    struct path_copying {
+        using key_t = typename Node::key_type;
+
+        template<typename K>
+        static Node const *find(Node const *t, K const &key, Compare const &cmp) {
+            while (t != nullptr) {
+                if (cmp(key, t->key)) {
+                    t = t->left;
+                } else if (cmp(t->key, key)) {
+                    t = t->right;
+                } else {
+                    return t;
+                }
+            }
+            return nullptr;
+        }
+
+        // Keys less than key go to the first tree.
+        template<typename Owner>
+        static std::pair<Node const *, Node const *> split(Node const *t, key_t const &key, Compare const &cmp,
+                                                           Owner &owner) {
+            if (t == nullptr) {
+                return {nullptr, nullptr};
+            }
+            if (cmp(t->key, key)) {
+                auto [l, r] = split(t->right, key, cmp, owner);
+                Node const *res = owner.copy(*t, owner.share(t->left), l);
+                owner.replaced(t);
+                return {res, r};
+            } else {
+                auto [l, r] = split(t->left, key, cmp, owner);
+                Node const *res = owner.copy(*t, r, owner.share(t->right));
+                owner.replaced(t);
+                return {l, res};
+            }
+        }
+
+        // All keys of l have to be less than keys of r.
+        template<typename Owner>
+        static Node const *merge(Node const *l, Node const *r, Owner &owner) {
+            if (l == nullptr) {
+                return owner.share(r);
+            }
+            if (r == nullptr) {
+                return owner.share(l);
+            }
+            Node const *res;
+            if (l->priority > r->priority) {
+                Node const *right = merge(l->right, r, owner);
+                res = owner.copy(*l, owner.share(l->left), right);
+                owner.replaced(l);
+            } else {
+                Node const *left = merge(l, r->left, owner);
+                res = owner.copy(*r, left, owner.share(r->right));
+                owner.replaced(r);
+            }
+            return res;
+        }
+
+        // The key of proto has to be absent, the new node takes the key and the value of proto.
+        template<typename Owner>
+        static Node const *insert(Node const *t, Node &proto, Compare const &cmp, Owner &owner) {
+            if (t == nullptr || proto.priority > t->priority) {
+                auto [l, r] = split(t, proto.key, cmp, owner);
+                return owner.copy(std::move(proto), l, r);
+            }
+            Node const *res;
+            if (cmp(proto.key, t->key)) {
+                Node const *left = insert(t->left, proto, cmp, owner);
+                res = owner.copy(*t, left, owner.share(t->right));
+            } else {
+                Node const *right = insert(t->right, proto, cmp, owner);
+                res = owner.copy(*t, owner.share(t->left), right);
+            }
+            owner.replaced(t);
+            return res;
+        }
+
+        // The key has to be present.
+        template<typename Owner>
+        static Node const *erase(Node const *t, key_t const &key, Compare const &cmp, Owner &owner) {
+            Node const *res;
+            if (cmp(key, t->key)) {
+                Node const *left = erase(t->left, key, cmp, owner);
+                res = owner.copy(*t, left, owner.share(t->right));
+            } else if (cmp(t->key, key)) {
+                Node const *right = erase(t->right, key, cmp, owner);
+                res = owner.copy(*t, owner.share(t->left), right);
+            } else {
+                res = merge(t->left, t->right, owner);
+            }
+            owner.replaced(t);
+            return res;
+        }
+    };
+}
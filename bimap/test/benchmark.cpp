@@ -0,0 +1,883 @@
+#include "src/bimap.h"
+#include "src/concurrent_bimap.h"
+#include "src/flat_bimap.h"
+#include "src/hash_bimap.h"
+#include "src/mapped_bimap.h"
+#include "src/persistent_bimap.h"
+
+#include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+
+namespace {
+    // Sizes of benchmarks are multiplied by BIMAP_BENCHMARK_SCALE (1 by default),
+    // so they stay cheap in the usual test run.
+    std::size_t scaled(std::size_t n) {
+        char const *scale = std::getenv("BIMAP_BENCHMARK_SCALE");
+        return scale != nullptr ? n * std::max(1L, std::atol(scale)) : n;
+    }
+
+    template<typename F>
+    double measure_ms(F &&f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    using element = intrusive::map_element<int, int>;
+    using left_map = intrusive::map<int, int, std::less<int>, intrusive::tag_left>;
+
+    // Inserts and then erases all keys, returns time in ms for both stages
+    template<typename Insert, typename Erase>
+    std::pair<double, double> fill_and_clear(std::vector<int> const &keys, Insert insert, Erase erase) {
+        std::mt19937 e(42);
+        std::vector<element> nodes;
+        nodes.reserve(keys.size());
+        for (int k : keys) {
+            nodes.emplace_back(k, k, static_cast<int>(e()));
+        }
+        left_map m;
+        double insert_time = measure_ms([&] {
+            for (auto &nd : nodes) {
+                insert(m, &intrusive::to_base<element, intrusive::tag_left>(nd));
+            }
+        });
+        double erase_time = measure_ms([&] {
+            for (int k : keys) {
+                erase(m, k);
+            }
+        });
+        EXPECT_EQ(m.begin(), m.end());
+        return {insert_time, erase_time};
+    }
+
+    bimap<int, int> random_bimap(std::size_t n, std::mt19937 &e) {
+        bimap<int, int> b;
+        while (b.size() < n) {
+            b.insert(static_cast<int>(e()), static_cast<int>(e()));
+        }
+        return b;
+    }
+}
+
+TEST(bimap_benchmark, copy) {
+    std::mt19937 e(1488228);
+    std::cout << "size\tcopy, ms\treinsert, ms" << std::endl;
+    for (std::size_t n = 1 << 10; n <= scaled(1 << 16); n <<= 2) {
+        bimap<int, int> b = random_bimap(n, e);
+
+        // Copies are destroyed outside of measurements
+        bimap<int, int> copy, reinserted;
+        double copy_time = measure_ms([&] {
+            copy = b;
+        });
+        double reinsert_time = measure_ms([&] {
+            for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+                reinserted.insert(*it, *it.flip());
+            }
+        });
+        EXPECT_EQ(copy, b);
+        EXPECT_EQ(reinserted, b);
+        std::cout << n << '\t' << copy_time << '\t' << reinsert_time << std::endl;
+    }
+}
+
+TEST(bimap_benchmark, allocator) {
+    std::size_t n = scaled(1 << 15);
+    std::vector<int> keys(n);
+    std::mt19937 e(1488228);
+    for (auto &k : keys) {
+        k = static_cast<int>(e());
+    }
+    auto churn = [&](auto &b) {
+        for (std::size_t round = 0; round < 4; round++) {
+            for (int k : keys) {
+                b.insert(k, k);
+            }
+            for (int k : keys) {
+                b.erase_left(k);
+            }
+        }
+    };
+
+    bimap<int, int> slab;
+    bimap<int, int, std::less<int>, std::less<int>, std::allocator<std::pair<int, int>>> plain;
+    std::cout << "insert/erase of " << n << " pairs, slab: " << measure_ms([&] { churn(slab); })
+              << " ms, std::allocator: " << measure_ms([&] { churn(plain); }) << " ms" << std::endl;
+    EXPECT_TRUE(slab.empty());
+    EXPECT_TRUE(plain.empty());
+}
+
+TEST(bimap_benchmark, iterative_treap) {
+    std::size_t n = scaled(1 << 16);
+    std::vector<int> sequential(n), random(n);
+    for (std::size_t i = 0; i < n; i++) {
+        sequential[i] = random[i] = static_cast<int>(i);
+    }
+    std::shuffle(random.begin(), random.end(), std::mt19937(1488228));
+
+    std::cout << "keys\timplementation\tinsert, ms\terase, ms" << std::endl;
+    for (auto const &[name, keys] : {std::pair{"sequential", &sequential}, std::pair{"random", &random}}) {
+        auto iterative = fill_and_clear(*keys, [](left_map &m, intrusive::node_base *n) { m.insert(n); },
+                                        [](left_map &m, int k) { m.erase(k); });
+        auto recursive = fill_and_clear(*keys, [](left_map &m, intrusive::node_base *n) { m.insert_recursive(n); },
+                                        [](left_map &m, int k) { m.erase_recursive(k); });
+        std::cout << name << "\titerative\t" << iterative.first << '\t' << iterative.second << std::endl;
+        std::cout << name << "\trecursive\t" << recursive.first << '\t' << recursive.second << std::endl;
+    }
+}
+
+TEST(bimap_benchmark, concurrent_fill) {
+    std::size_t n = scaled(1 << 15);
+    std::cout << "threads\tinserts per ms" << std::endl;
+    for (std::size_t threads = 1; threads <= std::max(4u, std::thread::hardware_concurrency()); threads *= 2) {
+        std::vector<bimap<int, int>> maps(threads);
+        double time = measure_ms([&] {
+            std::vector<std::thread> workers;
+            for (std::size_t t = 0; t < threads; t++) {
+                workers.emplace_back([&b = maps[t], n, t] {
+                    std::mt19937 e(static_cast<std::uint32_t>(t));
+                    for (std::size_t i = 0; i < n; i++) {
+                        b.insert(static_cast<int>(e()), static_cast<int>(e()));
+                    }
+                });
+            }
+            for (auto &w : workers) {
+                w.join();
+            }
+        });
+        std::cout << threads << '\t' << static_cast<double>(threads * n) / time << std::endl;
+    }
+}
+
+namespace {
+    template<typename Policy, typename Key, typename MakeKey>
+    void benchmark_layout(char const *name, std::size_t n, MakeKey make_key) {
+        using bm = bimap<Key, Key, std::less<Key>, std::less<Key>, intrusive::slab_allocator<std::pair<Key, Key>>, Policy>;
+        std::mt19937 e(1488228);
+        std::vector<std::pair<Key, Key>> data;
+        for (std::size_t i = 0; i < n; i++) {
+            data.emplace_back(make_key(e()), make_key(e()));
+        }
+        bm b(data.begin(), data.end());
+        std::shuffle(data.begin(), data.end(), e);
+
+        std::size_t found = 0;
+        double left_time = measure_ms([&] {
+            for (auto const &p : data) {
+                found += b.find_left(p.first) != b.end_left();
+            }
+        });
+        double right_time = measure_ms([&] {
+            for (auto const &p : data) {
+                found += b.find_right(p.second) != b.end_right();
+            }
+        });
+        EXPECT_GE(found, b.size());
+        std::cout << name << '\t' << n << '\t' << left_time << '\t' << right_time << std::endl;
+    }
+}
+
+// BIMAP_BENCHMARK_SCALE=153 gives 10M-element maps (the bimap_benchmark_layout_10m target)
+TEST(bimap_benchmark, layout) {
+    std::size_t n = scaled(1 << 16);
+    auto int_key = [](std::uint32_t x) { return static_cast<int>(x); };
+    auto string_key = [](std::uint32_t x) { return "key-" + std::to_string(x); };
+    std::cout << "layout, keys\tsize\tfind_left, ms\tfind_right, ms" << std::endl;
+    benchmark_layout<intrusive::default_policy, int>("separate, int", n, int_key);
+    benchmark_layout<intrusive::colocated_policy, int>("colocated, int", n, int_key);
+    benchmark_layout<intrusive::default_policy, std::string>("separate, string", n, string_key);
+    benchmark_layout<intrusive::colocated_policy, std::string>("colocated, string", n, string_key);
+}
+
+namespace {
+    template<typename BM>
+    void benchmark_point_lookups(char const *name, std::vector<std::pair<int, int>> const &data) {
+        std::mt19937 e(1488228);
+        std::vector<std::pair<int, int>> queries = data;
+        std::shuffle(queries.begin(), queries.end(), e);
+
+        BM b;
+        double insert_time = measure_ms([&] {
+            for (auto const &p : data) {
+                b.insert(p.first, p.second);
+            }
+        });
+        std::size_t found = 0;
+        double find_time = measure_ms([&] {
+            for (auto const &p : queries) {
+                found += b.find_left(p.first) != b.end_left();
+                found += b.find_right(p.second) != b.end_right();
+            }
+        });
+        double erase_time = measure_ms([&] {
+            for (auto const &p : queries) {
+                b.erase_left(p.first);
+            }
+        });
+        EXPECT_EQ(found, 2 * data.size());
+        EXPECT_TRUE(b.empty());
+        std::cout << name << '\t' << data.size() << '\t' << insert_time << '\t' << find_time << '\t' << erase_time
+                  << std::endl;
+    }
+}
+
+TEST(bimap_benchmark, hash_index) {
+    std::mt19937 e(1488228);
+    std::cout << "index\tsize\tinsert, ms\tfind both, ms\terase, ms" << std::endl;
+    for (std::size_t n = 1 << 12; n <= scaled(1 << 16); n <<= 2) {
+        bimap<int, int> unique = random_bimap(n, e);
+        std::vector<std::pair<int, int>> data;
+        for (auto it = unique.begin_left(); it != unique.end_left(); ++it) {
+            data.emplace_back(*it, *it.flip());
+        }
+        std::shuffle(data.begin(), data.end(), e);
+        benchmark_point_lookups<bimap<int, int>>("treap", data);
+        benchmark_point_lookups<hash_bimap<int, int>>("hash", data);
+    }
+}
+
+namespace {
+    // Lookups per ms of readers running together with a writer which keeps inserting and erasing
+    template<typename Find, typename Update>
+    double reader_throughput(std::size_t threads, std::size_t lookups, Find find, Update update) {
+        std::atomic<bool> done{false};
+        std::thread writer([&] {
+            std::mt19937 e(1);
+            while (!done.load()) {
+                update(static_cast<int>(e() % (1 << 16)));
+            }
+        });
+        double time = measure_ms([&] {
+            std::vector<std::thread> readers;
+            for (std::size_t t = 0; t < threads; t++) {
+                readers.emplace_back([&, t] {
+                    std::mt19937 e(static_cast<std::uint32_t>(t));
+                    std::size_t found = 0;
+                    for (std::size_t i = 0; i < lookups; i++) {
+                        found += find(static_cast<int>(e() % (1 << 16)));
+                    }
+                    EXPECT_LE(found, lookups);
+                });
+            }
+            for (auto &r : readers) {
+                r.join();
+            }
+        });
+        done = true;
+        writer.join();
+        return static_cast<double>(threads * lookups) / time;
+    }
+}
+
+TEST(bimap_benchmark, concurrent_readers) {
+    std::size_t lookups = scaled(1 << 15);
+    concurrent_bimap<int, int> concurrent;
+    bimap<int, int> locked;
+    std::mutex m;
+    for (int i = 0; i < (1 << 16); i += 2) {
+        concurrent.insert(i, -i);
+        locked.insert(i, -i);
+    }
+    auto toggle = [](auto &b, int k) {
+        if (!b.erase_left(k)) {
+            b.insert(k, -k);
+        }
+    };
+
+    std::cout << "readers\tconcurrent_bimap, lookups per ms\tbimap with mutex, lookups per ms" << std::endl;
+    for (std::size_t threads = 1; threads <= std::max(4u, std::thread::hardware_concurrency()); threads *= 2) {
+        double lock_free = reader_throughput(threads, lookups,
+                                             [&](int k) { return concurrent.find_left(k).has_value(); },
+                                             [&](int k) { toggle(concurrent, k); });
+        double with_mutex = reader_throughput(threads, lookups,
+                                              [&](int k) {
+                                                  std::lock_guard<std::mutex> lock(m);
+                                                  return locked.find_left(k) != locked.end_left();
+                                              },
+                                              [&](int k) {
+                                                  std::lock_guard<std::mutex> lock(m);
+                                                  toggle(locked, k);
+                                              });
+        std::cout << threads << '\t' << lock_free << '\t' << with_mutex << std::endl;
+    }
+}
+
+TEST(bimap_benchmark, persistent_snapshot) {
+    std::mt19937 e(1488228);
+    std::cout << "size\tsnapshot, ms\tbimap copy, ms\tpersistent insert, ms\tbimap insert, ms" << std::endl;
+    for (std::size_t n = 1 << 12; n <= scaled(1 << 16); n <<= 2) {
+        std::vector<std::pair<int, int>> data;
+        bimap<int, int> b = random_bimap(n, e);
+        persistent_bimap<int, int> p;
+        for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+            data.emplace_back(*it, *it.flip());
+        }
+        std::shuffle(data.begin(), data.end(), e);
+
+        bimap<int, int> inserted;
+        double bimap_insert_time = measure_ms([&] {
+            for (auto const &d : data) {
+                inserted.insert(d.first, d.second);
+            }
+        });
+        double persistent_insert_time = measure_ms([&] {
+            for (auto const &d : data) {
+                p = p.insert(d.first, d.second);
+            }
+        });
+
+        // A snapshot per 1024 updates
+        std::size_t snapshots = std::max<std::size_t>(1, n / 1024);
+        std::vector<persistent_bimap<int, int>> taken;
+        std::vector<bimap<int, int>> copied;
+        double snapshot_time = measure_ms([&] {
+            for (std::size_t i = 0; i < snapshots; i++) {
+                taken.push_back(p);
+            }
+        });
+        double copy_time = measure_ms([&] {
+            for (std::size_t i = 0; i < snapshots; i++) {
+                copied.push_back(b);
+            }
+        });
+        EXPECT_EQ(p.size(), b.size());
+        std::cout << n << '\t' << snapshot_time << '\t' << copy_time << '\t' << persistent_insert_time << '\t'
+                  << bimap_insert_time << std::endl;
+    }
+}
+
+// BIMAP_BENCHMARK_SCALE=16 gives 1M + 1M merges (the bimap_benchmark_merge_1m target)
+TEST(bimap_benchmark, merge) {
+    std::size_t n = scaled(1 << 16);
+    auto checksum = [](bimap<int, int> const &b) {
+        std::uint64_t res = 0;
+        for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+            res = res * 1000003 + static_cast<std::uint32_t>(*it) * 31 + static_cast<std::uint32_t>(*it.flip());
+        }
+        return res;
+    };
+    std::cout << "size\tthreads\tmerge, ms\tinserts, ms" << std::endl;
+    for (std::size_t threads : {std::size_t(1), std::size_t(std::max(4u, std::thread::hardware_concurrency()))}) {
+        // Both stages build the same operands from the seed, so only two bimaps are alive at once
+        std::size_t expected_size;
+        std::uint64_t expected_checksum;
+        double insert_time;
+        {
+            std::mt19937 e(1488228);
+            bimap<int, int> a = random_bimap(n, e), b = random_bimap(n, e);
+            insert_time = measure_ms([&] {
+                for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+                    a.insert(*it, *it.flip());
+                }
+            });
+            expected_size = a.size();
+            expected_checksum = checksum(a);
+        }
+        std::mt19937 e(1488228);
+        bimap<int, int> a = random_bimap(n, e), b = random_bimap(n, e);
+        double merge_time = measure_ms([&] {
+            a.merge(std::move(b), threads);
+        });
+        EXPECT_EQ(a.size(), expected_size);
+        EXPECT_EQ(checksum(a), expected_checksum);
+        std::cout << n << " + " << n << '\t' << threads << '\t' << merge_time << '\t' << insert_time << std::endl;
+    }
+}
+
+TEST(bimap_benchmark, find_batch) {
+    std::mt19937 e(1488228);
+    std::cout << "size\tbatch\tscalar, ms\tbatched, ms" << std::endl;
+    for (std::size_t n = 1 << 12; n <= scaled(1 << 18); n <<= 3) {
+        bimap<int, int> b = random_bimap(n, e);
+        std::vector<int> keys;
+        for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+            keys.push_back(*it);
+        }
+        std::shuffle(keys.begin(), keys.end(), e);
+        for (std::size_t batch : {64, 1024}) {
+            std::vector<bimap<int, int>::left_iterator> found(batch);
+            std::size_t hits = 0;
+            double scalar_time = measure_ms([&] {
+                for (std::size_t i = 0; i + batch <= keys.size(); i += batch) {
+                    for (std::size_t j = 0; j < batch; j++) {
+                        found[j] = b.find_left(keys[i + j]);
+                    }
+                    hits += found[batch - 1] != b.end_left();
+                }
+            });
+            double batch_time = measure_ms([&] {
+                for (std::size_t i = 0; i + batch <= keys.size(); i += batch) {
+                    b.find_left_batch(keys.begin() + i, keys.begin() + i + batch, found.begin());
+                    hits += found[batch - 1] != b.end_left();
+                }
+            });
+            EXPECT_EQ(hits, 2 * (keys.size() / batch));
+            std::cout << n << '\t' << batch << '\t' << scalar_time << '\t' << batch_time << std::endl;
+        }
+    }
+}
+
+TEST(bimap_benchmark, count_range) {
+    using counted = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<std::pair<int, int>>,
+            intrusive::order_statistics_policy>;
+    std::size_t n = scaled(1 << 16);
+    counted b;
+    for (int i = 0; b.size() < n; i++) {
+        b.insert(i, -i);
+    }
+    std::mt19937 e(1488228);
+    std::vector<std::pair<int, int>> queries(1 << 10);
+    for (auto &q : queries) {
+        q.first = static_cast<int>(e() % n);
+        q.second = q.first + static_cast<int>(e() % (n / 8));
+    }
+
+    std::size_t walked = 0, counted_total = 0;
+    double walk_time = measure_ms([&] {
+        for (auto const &q : queries) {
+            for (auto it = b.lower_bound_left(q.first), last = b.lower_bound_left(q.second); it != last; ++it) {
+                walked++;
+            }
+        }
+    });
+    double view_time = measure_ms([&] {
+        for (auto const &q : queries) {
+            for (int l : b.range_left(q.first, q.second)) {
+                walked -= l >= q.first;
+            }
+        }
+    });
+    double count_time = measure_ms([&] {
+        for (auto const &q : queries) {
+            counted_total += b.count_range_left(q.first, q.second);
+        }
+    });
+    EXPECT_EQ(walked, 0);
+    std::cout << queries.size() << " range queries over " << n << " keys, bounds + walk: " << walk_time
+              << " ms, range view: " << view_time << " ms, count_range: " << count_time << " ms" << std::endl;
+    EXPECT_GT(counted_total, 0);
+}
+
+TEST(bimap_benchmark, flat) {
+    std::mt19937 e(1488228);
+    std::cout << "size\tbuild: flat, ms\ttreap, ms\tfind both: flat, ms\ttreap, ms\tbytes per pair: flat\ttreap" << std::endl;
+    for (std::size_t n = 1 << 12; n <= scaled(1 << 18); n <<= 3) {
+        std::vector<std::pair<int, int>> data;
+        for (std::size_t i = 0; i < n; i++) {
+            data.emplace_back(static_cast<int>(e()), static_cast<int>(e()));
+        }
+        flat_bimap<int, int> f;
+        bimap<int, int> b;
+        double flat_build = measure_ms([&] {
+            f = flat_bimap<int, int>(data.begin(), data.end());
+        });
+        double treap_build = measure_ms([&] {
+            b = bimap<int, int>(data.begin(), data.end());
+        });
+        std::shuffle(data.begin(), data.end(), e);
+
+        std::size_t found = 0;
+        double flat_find = measure_ms([&] {
+            for (auto const &p : data) {
+                found += f.find_left(p.first) != f.end_left();
+                found += f.find_right(p.second) != f.end_right();
+            }
+        });
+        double treap_find = measure_ms([&] {
+            for (auto const &p : data) {
+                found += b.find_left(p.first) != b.end_left();
+                found += b.find_right(p.second) != b.end_right();
+            }
+        });
+        EXPECT_EQ(f.size(), b.size());
+        EXPECT_GE(found, 4 * f.size());
+        std::size_t flat_bytes = 2 * sizeof(int) + 2 * sizeof(std::uint32_t);
+        std::size_t treap_bytes = sizeof(intrusive::map_element<int, int>);
+        std::cout << n << '\t' << flat_build << '\t' << treap_build << '\t' << flat_find << '\t' << treap_find
+                  << '\t' << flat_bytes << '\t' << treap_bytes << std::endl;
+    }
+}
+
+TEST(bimap_benchmark, save_load) {
+    std::mt19937 e(1488228);
+    std::size_t n = scaled(1 << 17);
+    bimap<int, int> b = random_bimap(n, e);
+    std::vector<std::pair<int, int>> pairs;
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+        pairs.emplace_back(*it, *it.flip());
+    }
+    std::shuffle(pairs.begin(), pairs.end(), e);
+
+    std::stringstream image;
+    double save_time = measure_ms([&] {
+        b.save(image);
+    });
+    bimap<int, int> loaded;
+    double load_time = measure_ms([&] {
+        loaded = bimap<int, int>::load(image);
+    });
+    bimap<int, int> inserted;
+    double insert_time = measure_ms([&] {
+        for (auto const &p : pairs) {
+            inserted.insert(p.first, p.second);
+        }
+    });
+    EXPECT_EQ(loaded, b);
+    EXPECT_EQ(inserted, b);
+
+    std::string path = testing::TempDir() + "bimap_benchmark.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << image.str();
+    }
+    std::size_t found = 0;
+    double mapped_time = measure_ms([&] {
+        mapped_bimap<int, int> m(path);
+        for (std::size_t i = 0; i < pairs.size(); i += 16) {
+            found += m.find_right(pairs[i].second) != m.end_right();
+        }
+    });
+    std::remove(path.c_str());
+    EXPECT_EQ(found, (pairs.size() + 15) / 16);
+    std::cout << n << " pairs, save: " << save_time << " ms, load: " << load_time << " ms, inserts: "
+              << insert_time << " ms, map and " << found << " finds: " << mapped_time << " ms" << std::endl;
+}
+
+TEST(bimap_benchmark, statistics) {
+    using instrumented = bimap<int, int, std::less<int>, std::less<int>,
+            intrusive::slab_allocator<std::pair<int, int>>, intrusive::statistics_policy>;
+    std::mt19937 e(1488228);
+    std::cout << "statistics\tsize\tinsert, ms\tfind both, ms\terase, ms" << std::endl;
+    for (std::size_t n = 1 << 14; n <= scaled(1 << 18); n <<= 4) {
+        bimap<int, int> unique = random_bimap(n, e);
+        std::vector<std::pair<int, int>> data;
+        for (auto it = unique.begin_left(); it != unique.end_left(); ++it) {
+            data.emplace_back(*it, *it.flip());
+        }
+        std::shuffle(data.begin(), data.end(), e);
+        benchmark_point_lookups<bimap<int, int>>("off", data);
+        benchmark_point_lookups<instrumented>("on", data);
+    }
+}
+
+namespace {
+    // Latency of each operation in ns, sorted
+    template<typename Op>
+    std::vector<double> latencies(std::vector<int> const &keys, Op op) {
+        std::vector<double> res;
+        res.reserve(keys.size());
+        for (int k : keys) {
+            auto start = std::chrono::steady_clock::now();
+            op(k);
+            res.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    template<typename BM>
+    void benchmark_balancing(char const *name, char const *order, std::vector<int> const &keys) {
+        std::vector<int> queries = keys;
+        std::shuffle(queries.begin(), queries.end(), std::mt19937(1488228));
+        BM b;
+        std::vector<double> insert = latencies(keys, [&](int k) { b.insert(k, k); });
+        std::vector<double> find = latencies(queries, [&](int k) { b.find_right(k); });
+        std::vector<double> erase = latencies(keys, [&](int k) { b.erase_left(k); });
+        EXPECT_TRUE(b.empty());
+        for (auto const &[op, ns] : {std::pair{"insert", &insert}, std::pair{"find", &find}, std::pair{"erase", &erase}}) {
+            auto at = [&](double q) { return (*ns)[static_cast<std::size_t>(q * (ns->size() - 1))]; };
+            std::cout << name << '\t' << order << '\t' << op << '\t' << at(0.5) << '\t' << at(0.99) << '\t'
+                      << at(0.999) << '\t' << ns->back() << std::endl;
+        }
+    }
+}
+
+TEST(bimap_benchmark, balancing) {
+    using wavl = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<std::pair<int, int>>,
+            intrusive::wavl_policy>;
+    std::size_t n = scaled(1 << 16);
+    std::vector<int> sequential(n), random(n);
+    for (std::size_t i = 0; i < n; i++) {
+        sequential[i] = random[i] = static_cast<int>(i);
+    }
+    std::shuffle(random.begin(), random.end(), std::mt19937(1488228));
+
+    std::cout << "balancing\tkeys\top\tp50, ns\tp99, ns\tp99.9, ns\tmax, ns" << std::endl;
+    for (auto const &[order, keys] : {std::pair{"sequential", &sequential}, std::pair{"random", &random}}) {
+        benchmark_balancing<bimap<int, int>>("treap", order, *keys);
+        benchmark_balancing<wavl>("wavl", order, *keys);
+    }
+}
+
+TEST(bimap_benchmark, extract_insert) {
+    using bm = bimap<int, std::string>;
+    std::size_t n = scaled(1 << 15);
+    std::mt19937 e(1488228);
+    bm hot;
+    bm cold(std::less<int>(), std::less<std::string>(), hot.get_allocator());
+    std::vector<int> keys;
+    while (hot.size() < n) {
+        int k = static_cast<int>(e());
+        // Copies allocate and copy 200 bytes, comparisons stop at the number
+        if (hot.insert(k, std::to_string(k) + std::string(200, '.')) != hot.end_left()) {
+            keys.push_back(k);
+        }
+    }
+
+    // Each round moves everything to cold and back
+    double copy_time = measure_ms([&] {
+        for (int round = 0; round < 2; round++) {
+            for (int k : keys) {
+                auto it = hot.find_left(k);
+                cold.insert(*it, *it.flip());
+                hot.erase_left(it);
+            }
+            std::swap(hot, cold);
+        }
+    });
+    double extract_time = measure_ms([&] {
+        for (int round = 0; round < 2; round++) {
+            for (int k : keys) {
+                cold.insert(hot.extract_left(hot.find_left(k)));
+            }
+            std::swap(hot, cold);
+        }
+    });
+    EXPECT_EQ(hot.size(), n);
+    EXPECT_TRUE(cold.empty());
+    std::cout << "moving " << n << " pairs twice, erase + insert: " << copy_time
+              << " ms, extract + insert: " << extract_time << " ms" << std::endl;
+}
+
+namespace {
+    // Value which is expensive to construct
+    struct label {
+        std::string text;
+
+        explicit label(std::size_t id) : text(std::to_string(id) + std::string(100, '.')) {}
+
+        bool operator<(label const &other) const {
+            return text < other.text;
+        }
+
+        bool operator==(label const &other) const {
+            return text == other.text;
+        }
+    };
+}
+
+TEST(bimap_benchmark, try_emplace) {
+    std::size_t n = scaled(1 << 16);
+    std::mt19937 e(1488228);
+    // Most left keys come twice or more, then there is nothing to insert
+    std::vector<int> keys(n);
+    for (auto &k : keys) {
+        k = static_cast<int>(e() % (n / 2));
+    }
+
+    bimap<int, label> inserted, emplaced;
+    double insert_time = measure_ms([&] {
+        for (std::size_t i = 0; i < n; i++) {
+            inserted.insert(keys[i], label(i));
+        }
+    });
+    double emplace_time = measure_ms([&] {
+        for (std::size_t i = 0; i < n; i++) {
+            emplaced.try_emplace_left(keys[i], i);
+        }
+    });
+    EXPECT_EQ(emplaced, inserted);
+    std::cout << n << " pairs with repeating left keys, insert: " << insert_time << " ms, try_emplace_left: "
+              << emplace_time << " ms" << std::endl;
+}
+
+TEST(bimap_benchmark, hinted_insert) {
+    using bm = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<int>,
+            intrusive::statistics_policy>;
+    std::size_t n = scaled(1 << 17);
+    std::mt19937 e(1488228);
+    // Timestamps which arrive nearly sorted (shuffled by blocks of 16) paired with random ids
+    std::vector<int> keys(n), ids(n);
+    for (std::size_t i = 0; i < n; i++) {
+        keys[i] = static_cast<int>(i);
+        ids[i] = static_cast<int>(e());
+    }
+    for (std::size_t i = 0; i + 16 <= n; i += 16) {
+        std::shuffle(keys.begin() + i, keys.begin() + i + 16, e);
+    }
+    // Comparisons of left keys per key
+    auto comparisons = [n](bm &b) {
+        double res = static_cast<double>(b.statistics().left.comparisons) / n;
+        b.reset_statistics();
+        return res;
+    };
+
+    bm plain, hinted;
+    double plain_time = measure_ms([&] {
+        for (std::size_t i = 0; i < n; i++) {
+            plain.insert(keys[i], ids[i]);
+        }
+    });
+    double plain_cmp = comparisons(plain);
+    double hinted_time = measure_ms([&] {
+        auto hint = hinted.end_left();
+        for (std::size_t i = 0; i < n; i++) {
+            hint = hinted.insert(hint, keys[i], ids[i]);
+        }
+    });
+    double hinted_cmp = comparisons(hinted);
+    EXPECT_EQ(plain.size(), hinted.size());
+    EXPECT_TRUE(std::equal(plain.begin_left(), plain.end_left(), hinted.begin_left(), hinted.end_left()));
+
+    std::size_t found = 0;
+    double lookup_time = measure_ms([&] {
+        for (int k : keys) {
+            found += plain.lower_bound_left(k) != plain.end_left();
+        }
+    });
+    double lookup_cmp = comparisons(plain);
+    double finger_time = measure_ms([&] {
+        auto hint = hinted.begin_left();
+        for (int k : keys) {
+            hint = hinted.lower_bound_left(hint, k);
+            found += hint != hinted.end_left();
+        }
+    });
+    double finger_cmp = comparisons(hinted);
+    EXPECT_EQ(found, 2 * n);
+    std::cout << n << " nearly sorted keys, ms (left comparisons per key)" << std::endl;
+    std::cout << "insert: " << plain_time << " (" << plain_cmp << "), hinted insert: " << hinted_time << " ("
+              << hinted_cmp << ")" << std::endl;
+    std::cout << "lower_bound: " << lookup_time << " (" << lookup_cmp << "), from the previous one: " << finger_time
+              << " (" << finger_cmp << ")" << std::endl;
+
+    // Sorted keys with sorted and random ids: hinted appends on both sides, then on the left one only
+    for (bool sorted_ids : {true, false}) {
+        bm sorted_plain, sorted_hinted;
+        auto id = [&](std::size_t i) { return sorted_ids ? static_cast<int>(i) : ids[i]; };
+        double sorted_plain_time = measure_ms([&] {
+            for (std::size_t i = 0; i < n; i++) {
+                sorted_plain.insert(static_cast<int>(i), id(i));
+            }
+        });
+        double sorted_hinted_time = measure_ms([&] {
+            auto hint = sorted_hinted.end_left();
+            for (std::size_t i = 0; i < n; i++) {
+                hint = sorted_hinted.insert(hint, static_cast<int>(i), id(i));
+            }
+        });
+        EXPECT_EQ(sorted_plain.size(), sorted_hinted.size());
+        std::cout << "sorted keys, " << (sorted_ids ? "sorted" : "random") << " ids, insert: " << sorted_plain_time
+                  << " (" << comparisons(sorted_plain) << "), hinted insert: " << sorted_hinted_time << " ("
+                  << comparisons(sorted_hinted) << ")" << std::endl;
+    }
+}
+
+TEST(bimap_benchmark, clear) {
+    std::size_t n = scaled(1 << 18);
+    std::mt19937 e(1488228);
+    std::cout << "clearing " << n << " pairs, ms" << std::endl;
+
+    auto run = [&](char const *name, auto make) {
+        auto erased = make();
+        auto cleared = make();
+        auto shared = make();
+        // Another user of the pool, so it can't be released at once
+        auto keeper = shared.get_allocator();
+        double erase_time = measure_ms([&] {
+            while (!erased.empty()) {
+                erased.erase_left(erased.begin_left());
+            }
+        });
+        double clear_time = measure_ms([&] {
+            cleared.clear();
+        });
+        double walk_time = measure_ms([&] {
+            shared.clear();
+        });
+        EXPECT_TRUE(cleared.empty() && shared.empty());
+        std::cout << name << ", erase one by one: " << erase_time << ", clear: " << clear_time
+                  << ", clear of a shared pool: " << walk_time << std::endl;
+    };
+    run("int keys", [&] {
+        return random_bimap(n, e);
+    });
+    run("string keys", [&] {
+        bimap<std::string, int> b;
+        while (b.size() < n) {
+            int k = static_cast<int>(e());
+            b.insert(std::to_string(k), k);
+        }
+        return b;
+    });
+}
+
+namespace {
+    // Not std::less, so bimaps with it are compared by the comparator
+    struct custom_less {
+        bool operator()(int a, int b) const {
+            return a < b;
+        }
+    };
+}
+
+TEST(bimap_benchmark, equality) {
+    std::size_t n = scaled(1 << 18);
+    std::mt19937 e(1488228);
+    // Distinct keys on both sides, so the order of insertions does not matter
+    std::vector<int> lefts(n), rights(n);
+    for (std::size_t i = 0; i < n; i++) {
+        lefts[i] = rights[i] = static_cast<int>(i);
+    }
+    std::shuffle(lefts.begin(), lefts.end(), e);
+    std::shuffle(rights.begin(), rights.end(), e);
+    std::vector<std::pair<int, int>> pairs;
+    for (std::size_t i = 0; i < n; i++) {
+        pairs.emplace_back(lefts[i], rights[i]);
+    }
+    using by_comparator = bimap<int, int, custom_less, custom_less>;
+    using fingerprinted = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<int>,
+            intrusive::fingerprint_policy>;
+
+    auto compare = [&](auto &a, auto &b) {
+        bool equal = true;
+        double time = measure_ms([&] {
+            for (int round = 0; round < 10; round++) {
+                equal &= a == b;
+            }
+        });
+        EXPECT_TRUE(equal);
+        return time / 10;
+    };
+    auto fill = [&](auto &a, auto &b) {
+        double time = measure_ms([&] {
+            for (auto const &p : pairs) {
+                a.insert(p.first, p.second);
+            }
+        });
+        for (auto it = pairs.rbegin(); it != pairs.rend(); ++it) {
+            b.insert(it->first, it->second);
+        }
+        return time;
+    };
+
+    by_comparator slow_a, slow_b;
+    bimap<int, int> fast_a, fast_b;
+    fingerprinted fp_a, fp_b;
+    double plain_insert = fill(fast_a, fast_b);
+    fill(slow_a, slow_b);
+    double fp_insert = fill(fp_a, fp_b);
+    std::cout << "comparing bimaps of " << n << " equal pairs, ms" << std::endl;
+    std::cout << "by comparator: " << compare(slow_a, slow_b) << ", by blocks: " << compare(fast_a, fast_b)
+              << ", fingerprints only: " << measure_ms([&] { EXPECT_EQ(fp_a.fingerprint(), fp_b.fingerprint()); })
+              << std::endl;
+    std::cout << "insert of all pairs: " << plain_insert << ", with the fingerprint: " << fp_insert << std::endl;
+}
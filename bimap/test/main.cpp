@@ -1,7 +1,21 @@
 #include "src/bimap.h"
+#include "src/concurrent_bimap.h"
+#include "src/flat_bimap.h"
+#include "src/hash_bimap.h"
+#include "src/mapped_bimap.h"
+#include "src/persistent_bimap.h"
 
 #include "gtest/gtest.h"
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
 #include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
 
 struct test_object {
     int a = 0;
@@ -103,6 +117,49 @@ TEST(bimap, custom_parametrized_comparator) {
     }
 }
 
+TEST(bimap, end_flip) {
+    using vec = std::pair<int, int>;
+    bimap<vec, vec, vector_compare, vector_compare> b((vector_compare(vector_compare::manhattan)));
+    b.insert({0, 1}, {35, 3});
+    EXPECT_EQ(b.end_left().flip(), b.end_right());
+    EXPECT_EQ(b.end_right().flip(), b.end_left());
+
+    auto moved = std::move(b);
+    EXPECT_EQ(moved.end_left().flip(), moved.end_right());
+    EXPECT_EQ(b.end_right().flip(), b.end_left());
+    b.swap(moved);
+    EXPECT_EQ(b.end_left().flip(), b.end_right());
+    EXPECT_EQ(moved.end_right().flip(), moved.end_left());
+    EXPECT_EQ(b.size(), 1);
+}
+
+TEST(bimap, colocated_layout) {
+    using colocated = bimap<int, std::string, std::less<int>, std::less<std::string>,
+            intrusive::slab_allocator<std::pair<int, std::string>>, intrusive::colocated_policy>;
+    colocated b;
+    std::map<int, std::string> view;
+    std::mt19937 e(99);
+    for (int i = 0; i < 3000; i++) {
+        int l = static_cast<int>(e() % 1000);
+        std::string r = std::to_string(e() % 1000);
+        if (e() % 4 == 0) {
+            EXPECT_EQ(b.erase_left(l), view.erase(l) == 1);
+        } else if (b.find_right(r) == b.end_right() && b.insert(l, r) != b.end_left()) {
+            view.emplace(l, r);
+        }
+    }
+    colocated copy(b);
+    ASSERT_EQ(copy.size(), view.size());
+    auto it = copy.begin_left();
+    for (auto const &p : view) {
+        EXPECT_EQ(*it, p.first);
+        EXPECT_EQ(*it.flip(), p.second);
+        EXPECT_EQ(copy.at_right(p.second), p.first);
+        ++it;
+    }
+    EXPECT_EQ(copy.end_left().flip(), copy.end_right());
+}
+
 TEST(bimap, copies) {
     bimap<int, int> b;
     b.insert(3, 4);
@@ -116,6 +173,270 @@ TEST(bimap, copies) {
     EXPECT_NE(b.find_right(-10), b.end_right());
 }
 
+TEST(bimap, copy_keeps_shape) {
+    bimap<int, int> b;
+    std::mt19937 e(7);
+    for (int i = 0; i < 1000; i++) {
+        b.insert(static_cast<int>(e() % 5000), static_cast<int>(e() % 5000));
+    }
+    bimap<int, int> copy(b);
+    EXPECT_EQ(copy.size(), b.size());
+    EXPECT_EQ(copy, b);
+    for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+        EXPECT_EQ(copy.at_right(*it), *it.flip());
+    }
+    EXPECT_TRUE(copy.erase_left(*b.begin_left()));
+    EXPECT_NE(copy, b);
+}
+
+TEST(bimap, std_allocator) {
+    bimap<int, int, std::less<>, std::less<>, std::allocator<std::pair<int, int>>> b;
+    for (int i = 0; i < 100; i++) {
+        b.insert(i, -i);
+    }
+    auto copy = b;
+    EXPECT_TRUE(b.erase_left(50));
+    EXPECT_EQ(copy.at_left(50), -50);
+    EXPECT_EQ(b.size(), 99);
+}
+
+TEST(bimap, shared_slab_pool) {
+    using bm = bimap<int, std::string>;
+    bm hot;
+    bm cold(std::less<int>(), std::less<std::string>(), hot.get_allocator());
+    EXPECT_TRUE(hot.get_allocator() == cold.get_allocator());
+    EXPECT_FALSE(bm(hot).get_allocator() == hot.get_allocator());
+    for (int i = 0; i < 1000; i++) {
+        hot.insert(i, std::to_string(i));
+        cold.insert(-i - 1, std::to_string(-i - 1));
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        hot.erase_left(i);
+        cold.insert(i, std::to_string(i));
+    }
+    {
+        bm moved(std::move(hot));
+        EXPECT_EQ(moved.size(), 500);
+        // The moved-from bimap gets a pool of its own
+        EXPECT_TRUE(moved.get_allocator() == cold.get_allocator());
+        hot.insert(1, "1");
+        EXPECT_FALSE(hot.get_allocator() == moved.get_allocator());
+    }
+    EXPECT_EQ(hot.at_left(1), "1");
+    EXPECT_EQ(cold.size(), 1500);
+    EXPECT_EQ(cold.at_left(998), "998");
+
+    static_assert(std::is_nothrow_default_constructible_v<bm>);
+    bm lazy;
+    EXPECT_TRUE(lazy.get_allocator() == lazy.get_allocator());
+    bm sharing(std::less<int>(), std::less<std::string>(), lazy.get_allocator());
+    lazy.insert(1, "1");
+    EXPECT_TRUE(lazy.get_allocator() == sharing.get_allocator());
+}
+
+TEST(intrusive_map, iterative_matches_recursive) {
+    using element = intrusive::map_element<int, int>;
+    using map = intrusive::map<int, int, std::less<int>, intrusive::tag_left>;
+    auto base = [](element &el) {
+        return &intrusive::to_base<element, intrusive::tag_left>(el);
+    };
+    auto shape = [](std::vector<element> &nodes) {
+        auto index = [&](intrusive::node_base const *n) -> std::ptrdiff_t {
+            return n == nullptr ? -1 : &intrusive::from_base<element, intrusive::tag_left>(*n) - nodes.data();
+        };
+        std::vector<std::ptrdiff_t> res;
+        for (auto &el : nodes) {
+            intrusive::node_base const &n = intrusive::to_base<element, intrusive::tag_left>(el);
+            res.push_back(index(n.left));
+            res.push_back(index(n.right));
+        }
+        return res;
+    };
+
+    std::mt19937 e(1234);
+    std::vector<element> a, b;
+    std::vector<int> keys;
+    a.reserve(2000);
+    b.reserve(2000);
+    map iterative, recursive;
+    for (int i = 0; i < 2000; i++) {
+        int key = static_cast<int>(e() % 100000) * 2000 + i;
+        int priority = static_cast<int>(e());
+        keys.push_back(key);
+        iterative.insert(base(a.emplace_back(key, key, priority)));
+        recursive.insert_recursive(base(b.emplace_back(key, key, priority)));
+    }
+    EXPECT_EQ(shape(a), shape(b));
+    for (int i = 0; i < 2000; i += 3) {
+        iterative.erase(keys[i]);
+        recursive.erase_recursive(keys[i]);
+    }
+    EXPECT_EQ(shape(a), shape(b));
+    for (auto it1 = iterative.begin(), it2 = recursive.begin(); it1 != iterative.end(); ++it1, ++it2) {
+        EXPECT_EQ(*it1, *it2);
+    }
+}
+
+TEST(intrusive_map, wavl_height) {
+    using element = intrusive::map_element<int, int, intrusive::wavl_policy>;
+    using map = intrusive::map<int, int, std::less<int>, intrusive::tag_left, intrusive::wavl_policy>;
+    auto log2 = [](std::size_t n) {
+        std::size_t res = 0;
+        while ((std::size_t(1) << res) < n + 1) {
+            res++;
+        }
+        return res;
+    };
+    std::vector<element> nodes;
+    nodes.reserve(4096);
+    map m;
+    std::set<int> expected;
+    // Sorted keys are the worst order for an unbalanced tree
+    for (int i = 0; i < 4096; i++) {
+        m.insert(&intrusive::to_base<element, intrusive::tag_left>(nodes.emplace_back(i, i, 0)));
+        expected.insert(i);
+    }
+    EXPECT_LE(m.height(), log2(expected.size()) + 1);
+
+    std::mt19937 e(4321);
+    for (int i = 0; i < 3000; i++) {
+        int key = static_cast<int>(e() % 4096);
+        if (expected.erase(key) != 0) {
+            m.erase(key);
+        }
+    }
+    EXPECT_LE(m.height(), 2 * log2(expected.size()));
+    EXPECT_TRUE(std::equal(m.begin(), m.end(), expected.begin(), expected.end()));
+}
+
+TEST(bimap, independent_concurrent_fill) {
+    std::vector<bimap<int, int>> maps(4);
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < maps.size(); t++) {
+        workers.emplace_back([&b = maps[t]] {
+            for (int i = 0; i < 5000; i++) {
+                b.insert(i, -i);
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    for (auto const &b : maps) {
+        EXPECT_EQ(b.size(), 5000);
+        EXPECT_EQ(b, maps[0]);
+    }
+}
+
+TEST(bimap, order_statistics) {
+    using ranked = bimap<int, int, std::less<int>, std::less<int>,
+            intrusive::slab_allocator<std::pair<int, int>>, intrusive::order_statistics_policy>;
+    std::mt19937 e(31337);
+    std::vector<std::pair<int, int>> data;
+    for (int i = 0; i < 500; i++) {
+        data.emplace_back(static_cast<int>(e() % 2000), static_cast<int>(e() % 2000));
+    }
+    ranked b(data.begin(), data.end());
+    for (int i = 0; i < 3000; i++) {
+        if (e() % 3 == 0) {
+            b.erase_left(static_cast<int>(e() % 2000));
+        } else {
+            b.insert(static_cast<int>(e() % 2000), static_cast<int>(e() % 2000));
+        }
+    }
+    ranked copy(b);
+
+    std::vector<int> lefts, rights;
+    for (auto it = copy.begin_left(); it != copy.end_left(); ++it) {
+        lefts.push_back(*it);
+        rights.push_back(*it.flip());
+    }
+    std::sort(rights.begin(), rights.end());
+    ASSERT_EQ(lefts.size(), copy.size());
+    for (std::size_t k = 0; k < lefts.size(); k++) {
+        EXPECT_EQ(*copy.nth_left(k), lefts[k]);
+        EXPECT_EQ(*copy.nth_right(k), rights[k]);
+        EXPECT_EQ(copy.nth_left(k).index(), k);
+        EXPECT_EQ(copy.rank_left(lefts[k]), k);
+        EXPECT_EQ(copy.rank_right(rights[k] + 1),
+                  std::lower_bound(rights.begin(), rights.end(), rights[k] + 1) - rights.begin());
+    }
+    EXPECT_EQ(copy.nth_left(copy.size()), copy.end_left());
+    EXPECT_EQ(copy.end_right().index(), copy.size());
+
+    using std::distance;
+    EXPECT_EQ(distance(copy.begin_left(), copy.end_left()), static_cast<std::ptrdiff_t>(copy.size()));
+    EXPECT_EQ(distance(copy.lower_bound_right(500), copy.lower_bound_right(1500)),
+              std::lower_bound(rights.begin(), rights.end(), 1500) - std::lower_bound(rights.begin(), rights.end(), 500));
+}
+
+TEST(bimap, statistics) {
+    static std::size_t calls = 0;
+    struct counting_less {
+        bool operator()(int a, int b) const {
+            ++calls;
+            return a < b;
+        }
+    };
+    using instrumented = bimap<int, int, counting_less, counting_less,
+            intrusive::slab_allocator<std::pair<int, int>>, intrusive::statistics_policy>;
+    // Without statistics a map is its fake node and the rightmost pointer, no counters
+    EXPECT_EQ(sizeof(intrusive::map<int, int, std::less<int>, intrusive::tag_left>),
+              sizeof(intrusive::node_base) + sizeof(intrusive::node_base *));
+
+    instrumented b;
+    std::mt19937 e(2020);
+    // A descent is not deeper than the tree was before it
+    std::size_t max_height = 0;
+    for (int i = 0; i < 1000; i++) {
+        b.insert(static_cast<int>(e() % 3000), static_cast<int>(e() % 3000));
+        max_height = std::max(max_height, b.statistics().left.max_depth);
+    }
+    std::size_t erased = 0;
+    for (int i = 0; i < 300; i++) {
+        erased += b.erase_right(static_cast<int>(e() % 3000));
+        max_height = std::max(max_height, b.statistics().left.max_depth);
+    }
+    for (int i = 0; i < 500; i++) {
+        b.find_left(static_cast<int>(e() % 3000));
+    }
+    EXPECT_THROW(b.at_right(-1), std::out_of_range);
+
+    auto st = b.statistics();
+    EXPECT_EQ(st.size, b.size());
+    EXPECT_EQ(st.left.insertions.count, 1000);
+    EXPECT_EQ(st.right.insertions.count, 0);
+    EXPECT_EQ(st.right.erasures.count, 300);
+    EXPECT_EQ(st.left.lookups.count, 500);
+    EXPECT_EQ(st.right.lookups.count, 1);
+    EXPECT_EQ(st.allocations - st.frees, b.size());
+    EXPECT_EQ(st.frees, erased);
+    EXPECT_EQ(st.left.comparisons + st.right.comparisons, calls);
+    EXPECT_EQ(st.left.insertions.comparisons + st.left.lookups.comparisons + st.right.erasures.comparisons +
+              st.right.lookups.comparisons, calls);
+    EXPECT_GE(st.left.max_depth, 10);
+    EXPECT_LE(st.left.lookups.max_comparisons, st.left.max_depth + 1);
+    std::uint64_t descents = 0;
+    for (std::size_t d = 0; d < st.left.depth_histogram.size(); d++) {
+        descents += st.left.depth_histogram[d];
+        if (st.left.depth_histogram[d] != 0) {
+            EXPECT_LE(d, max_height);
+        }
+    }
+    EXPECT_EQ(descents, 1500);
+
+    std::ostringstream out;
+    st.dump(out);
+    std::string text = out.str();
+    EXPECT_NE(text.find("bimap_operations_total{side=\"left\",op=\"insert\"} 1000\n"), std::string::npos);
+    EXPECT_NE(text.find("bimap_descent_depth_count{side=\"left\"} 1500\n"), std::string::npos);
+    EXPECT_NE(text.find("bimap_size " + std::to_string(b.size()) + "\n"), std::string::npos);
+
+    b.reset_statistics();
+    EXPECT_EQ(b.statistics().left.comparisons, 0);
+    EXPECT_EQ(b.statistics().allocations, 0);
+}
+
 TEST(bimap, insert) {
     bimap<int, int> b;
     b.insert(4, 10);
@@ -140,6 +461,228 @@ TEST(bimap, insert_move) {
     EXPECT_EQ(b2.at_right(3), y2);
 }
 
+TEST(bimap, extract_insert) {
+    using bm = bimap<int, std::string>;
+    bm hot;
+    bm cold(std::less<int>(), std::less<std::string>(), hot.get_allocator());
+    for (int i = 0; i < 100; i++) {
+        hot.insert(i, std::to_string(i));
+    }
+    cold.insert(1000, "5");
+
+    std::string const *key = &*hot.find_left(3).flip();
+    bm::node_type nh = hot.extract_left(hot.find_left(3));
+    EXPECT_EQ(hot.size(), 99);
+    EXPECT_EQ(hot.find_left(3), hot.end_left());
+    EXPECT_EQ(nh.left(), 3);
+    EXPECT_EQ(nh.right(), "3");
+    auto res = cold.insert(std::move(nh));
+    EXPECT_TRUE(res.inserted);
+    EXPECT_TRUE(res.node.empty());
+    EXPECT_EQ(&*res.position.flip(), key);
+    EXPECT_EQ(cold.at_right("3"), 3);
+
+    res = cold.insert(hot.extract_right("5"));
+    EXPECT_FALSE(res.inserted);
+    EXPECT_EQ(*res.position, 1000);
+    EXPECT_EQ(res.node.left(), 5);
+    res = hot.insert(std::move(res.node));
+    EXPECT_TRUE(res.inserted);
+    EXPECT_EQ(hot.at_left(5), "5");
+
+    EXPECT_TRUE(hot.extract_left(3).empty());
+    EXPECT_FALSE(cold.insert(bm::node_type()).inserted);
+    {
+        bm::node_type dropped = hot.extract_left(7);
+        EXPECT_TRUE(dropped);
+    }
+    EXPECT_EQ(hot.size(), 98);
+
+    bm other;
+    EXPECT_FALSE(other.get_allocator() == hot.get_allocator());
+    for (int i = 10; i < 20; i++) {
+        res = other.insert(hot.extract_left(i));
+        EXPECT_TRUE(res.inserted);
+    }
+    for (int i = 10; i < 20; i++) {
+        EXPECT_EQ(other.at_left(i), std::to_string(i));
+        EXPECT_EQ(hot.find_left(i), hot.end_left());
+    }
+    EXPECT_EQ(other.size(), 10);
+    EXPECT_EQ(hot.size(), 88);
+}
+
+// Key whose copy throws on demand and whose move is not noexcept
+struct throwing_copy {
+    static inline bool fail = false;
+
+    int a;
+
+    explicit throwing_copy(int a) : a(a) {}
+
+    throwing_copy(throwing_copy const &other) : a(other.a) {
+        if (fail) {
+            throw std::runtime_error("copy failed");
+        }
+    }
+
+    throwing_copy(throwing_copy &&other) : a(other.a) {}
+
+    friend bool operator<(throwing_copy const &c, throwing_copy const &b) {
+        return c.a < b.a;
+    }
+};
+
+TEST(bimap, extract_insert_strong_guarantee) {
+    using bm = bimap<std::string, throwing_copy>;
+    std::string const long_key(100, 'x');
+    bm from, to;
+    from.insert(long_key, throwing_copy(1));
+    bm::node_type nh = from.extract_left(long_key);
+
+    throwing_copy::fail = true;
+    EXPECT_THROW(to.insert(std::move(nh)), std::runtime_error);
+    throwing_copy::fail = false;
+    EXPECT_TRUE(to.empty());
+    ASSERT_FALSE(nh.empty());
+    EXPECT_EQ(nh.left(), long_key);
+    EXPECT_EQ(nh.right().a, 1);
+
+    auto res = to.insert(std::move(nh));
+    EXPECT_TRUE(res.inserted);
+    EXPECT_EQ(to.at_left(long_key).a, 1);
+}
+
+// Composite key which counts its constructions
+struct point_key {
+    static inline int constructed = 0;
+
+    int x, y;
+
+    point_key(int x, int y) : x(x), y(y) {
+        constructed++;
+    }
+
+    point_key(point_key const &other) : x(other.x), y(other.y) {
+        constructed++;
+    }
+
+    bool operator<(point_key const &other) const {
+        return std::tie(x, y) < std::tie(other.x, other.y);
+    }
+};
+
+template<typename Policy>
+void check_emplace() {
+    bimap<point_key, std::string, std::less<>, std::less<>, intrusive::slab_allocator<point_key>, Policy> b;
+    point_key::constructed = 0;
+    auto it = b.emplace(std::piecewise_construct, std::forward_as_tuple(1, 2), std::forward_as_tuple(3, 'a'));
+    EXPECT_EQ(it->x, 1);
+    EXPECT_EQ(*it.flip(), "aaa");
+    EXPECT_EQ(point_key::constructed, 1);
+
+    EXPECT_EQ(b.emplace(std::piecewise_construct, std::forward_as_tuple(1, 2), std::forward_as_tuple("b")),
+              b.end_left());
+    EXPECT_EQ(b.emplace(std::piecewise_construct, std::forward_as_tuple(5, 5), std::forward_as_tuple("aaa")),
+              b.end_left());
+    EXPECT_EQ(point_key::constructed, 3);
+    EXPECT_EQ(b.size(), 1);
+
+    point_key key(1, 2);
+    point_key::constructed = 0;
+    EXPECT_EQ(b.try_emplace_left(key, 2, 'b'), b.end_left());
+    EXPECT_EQ(b.try_emplace_left(point_key(1, 2), "c"), b.end_left());
+    EXPECT_EQ(point_key::constructed, 1);
+    EXPECT_EQ(b.try_emplace_left(point_key(2, 2), "aaa"), b.end_left());
+
+    it = b.try_emplace_left(point_key(2, 2), 2, 'b');
+    EXPECT_EQ(*it.flip(), "bb");
+    auto right = b.try_emplace_right("c", 0, 1);
+    EXPECT_EQ(right.flip()->y, 1);
+    EXPECT_EQ(b.try_emplace_right("c", 7, 7), b.end_right());
+    EXPECT_EQ(b.try_emplace_right("d", 0, 1), b.end_right());
+    EXPECT_EQ(b.size(), 3);
+    EXPECT_EQ(b.at_right("c").x, 0);
+}
+
+TEST(bimap, emplace) {
+    check_emplace<intrusive::default_policy>();
+    check_emplace<intrusive::colocated_policy>();
+    check_emplace<intrusive::wavl_policy>();
+}
+
+struct person {
+    int id;
+    std::string name;
+};
+
+// Lookups by id must not construct a person
+struct by_id {
+    using is_transparent = void;
+
+    bool operator()(person const &a, person const &b) const {
+        return a.id < b.id;
+    }
+
+    bool operator()(person const &a, int b) const {
+        return a.id < b;
+    }
+
+    bool operator()(int a, person const &b) const {
+        return a < b.id;
+    }
+};
+
+TEST(bimap, transparent_lookup) {
+    bimap<std::string, person, std::less<>, by_id> b;
+    b.insert("alice", person{3, "Alice"});
+    b.insert("bob", person{7, "Bob"});
+
+    std::string_view bob = "bob";
+    EXPECT_EQ(b.at_left(bob).id, 7);
+    EXPECT_EQ(*b.find_left("alice"), "alice");
+    EXPECT_EQ(b.find_left(std::string_view("carol")), b.end_left());
+    EXPECT_EQ(*b.lower_bound_left("b"), "bob");
+    EXPECT_EQ(b.upper_bound_left(bob), b.end_left());
+    EXPECT_THROW(b.at_left("carol"), std::out_of_range);
+
+    EXPECT_EQ(b.at_right(3), "alice");
+    EXPECT_EQ(b.find_right(5), b.end_right());
+    EXPECT_EQ(b.lower_bound_right(5)->name, "Bob");
+    EXPECT_EQ(b.upper_bound_right(7), b.end_right());
+    EXPECT_EQ(b.at_right(person{7, ""}), "bob");
+}
+
+TEST(bimap, find_batch) {
+    bimap<int, std::string> b;
+    for (int i = 0; i < 100; i += 2) {
+        b.insert(i, std::to_string(i));
+    }
+    std::vector<int> keys;
+    for (int i = -5; i < 105; i++) {
+        keys.push_back(i * 7 % 105);
+    }
+    std::vector<bimap<int, std::string>::left_iterator> found;
+    b.find_left_batch(keys.begin(), keys.end(), std::back_inserter(found));
+    ASSERT_EQ(found.size(), keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(found[i], b.find_left(keys[i]));
+    }
+
+    std::vector<std::string> rights = {"4", "5", "98", ""};
+    std::vector<bimap<int, std::string>::right_iterator> found_right(rights.size());
+    EXPECT_EQ(b.find_right_batch(rights.begin(), rights.end(), found_right.begin()), found_right.end());
+    EXPECT_EQ(*found_right[0].flip(), 4);
+    EXPECT_EQ(found_right[1], b.end_right());
+    EXPECT_EQ(*found_right[2].flip(), 98);
+    EXPECT_EQ(found_right[3], b.end_right());
+
+    bimap<int, std::string> empty;
+    std::vector<bimap<int, std::string>::left_iterator> none(3);
+    empty.find_left_batch(keys.begin(), keys.begin() + 3, none.begin());
+    EXPECT_EQ(none[2], empty.end_left());
+}
+
 TEST(bimap, at) {
     bimap<int, int> b;
     b.insert(4, 3);
@@ -227,6 +770,48 @@ TEST(bimap, erase_value) {
     EXPECT_EQ(b.size(), 1);
 }
 
+TEST(bimap, clear) {
+    // Released at once
+    bimap<int, int> b;
+    for (int i = 0; i < 1000; i++) {
+        b.insert(i, -i);
+    }
+    b.clear();
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(b.begin_left(), b.end_left());
+    EXPECT_EQ(b.find_right(-5), b.end_right());
+    b.insert(5, 6);
+    EXPECT_EQ(b.at_left(5), 6);
+
+    // Freed by the walk, the pool is shared with another bimap and with a node handle
+    using bm = bimap<std::string, int>;
+    bm s;
+    bm other(std::less<std::string>(), std::less<int>(), s.get_allocator());
+    for (int i = 0; i < 1000; i++) {
+        s.insert(std::to_string(i), i);
+        other.insert(std::to_string(i), i);
+    }
+    bm::node_type nh = s.extract_left("7");
+    s.clear();
+    EXPECT_TRUE(s.empty());
+    EXPECT_EQ(s.begin_right(), s.end_right());
+    EXPECT_EQ(other.size(), 1000);
+    EXPECT_EQ(other.at_right(999), "999");
+    EXPECT_TRUE(s.insert(std::move(nh)).inserted);
+    EXPECT_EQ(s.at_left("7"), 7);
+    other.clear();
+    other.clear();
+    EXPECT_TRUE(other.empty());
+
+    bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<int>, intrusive::statistics_policy> counted;
+    for (int i = 0; i < 100; i++) {
+        counted.insert(i, i);
+    }
+    counted.clear();
+    auto stats = counted.statistics();
+    EXPECT_EQ(stats.allocations, stats.frees);
+}
+
 TEST(bimap, erase_range) {
     bimap<int, int> b;
 
@@ -251,6 +836,54 @@ TEST(bimap, erase_range) {
     EXPECT_TRUE(b.empty());
 }
 
+TEST(bimap, erase_range_randomized) {
+    using ranked = bimap<int, int, std::less<int>, std::less<int>,
+            intrusive::slab_allocator<std::pair<int, int>>, intrusive::order_statistics_policy>;
+    std::mt19937 e(2021);
+    ranked b;
+    std::map<int, int> left_view, right_view;
+    for (int round = 0; round < 200; round++) {
+        for (int i = 0; i < 50; i++) {
+            int l = static_cast<int>(e() % 1000), r = static_cast<int>(e() % 1000);
+            if (b.insert(l, r) != b.end_left()) {
+                left_view[l] = r;
+                right_view[r] = l;
+            }
+        }
+        int a = static_cast<int>(e() % 1000), c = static_cast<int>(e() % 1000);
+        if (a > c) {
+            std::swap(a, c);
+        }
+        if (round % 2 == 0) {
+            EXPECT_EQ(b.erase_left(b.lower_bound_left(a), b.lower_bound_left(c)), b.lower_bound_left(c));
+            for (auto it = left_view.lower_bound(a); it != left_view.lower_bound(c);) {
+                right_view.erase(it->second);
+                it = left_view.erase(it);
+            }
+        } else {
+            EXPECT_EQ(b.erase_right(b.lower_bound_right(a), b.end_right()), b.end_right());
+            for (auto it = right_view.lower_bound(a); it != right_view.end();) {
+                left_view.erase(it->second);
+                it = right_view.erase(it);
+            }
+        }
+        ASSERT_EQ(b.size(), left_view.size());
+        EXPECT_EQ(b.end_left().index(), b.size());
+        EXPECT_EQ(b.end_right().index(), b.size());
+        auto it = b.begin_left();
+        for (auto const &p : left_view) {
+            EXPECT_EQ(*it, p.first);
+            EXPECT_EQ(*it.flip(), p.second);
+            ++it;
+        }
+        auto rit = b.begin_right();
+        for (auto const &p : right_view) {
+            EXPECT_EQ(*rit, p.first);
+            ++rit;
+        }
+    }
+}
+
 TEST(bimap, lower_bound) {
     bimap<int, int> b;
 
@@ -273,6 +906,200 @@ TEST(bimap, lower_bound) {
     EXPECT_EQ(b.lower_bound_left(100), b.end_left());
 }
 
+template<typename Policy>
+void check_finger_search() {
+    using bm = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<int>, Policy>;
+    std::mt19937 e(1488228);
+    bm b;
+    std::vector<typename bm::left_iterator> hints;
+    for (int i = 0; i < 1000; i++) {
+        b.insert(2 * static_cast<int>(e() % 2000), i);
+    }
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+        hints.push_back(it);
+    }
+    hints.push_back(b.end_left());
+    for (int i = 0; i < 10000; i++) {
+        int key = static_cast<int>(e() % 4010) - 5;
+        auto hint = hints[e() % hints.size()];
+        EXPECT_EQ(b.lower_bound_left(hint, key), b.lower_bound_left(key));
+    }
+
+    // Sorted runs hinted by the previous insertion, then random hints
+    bm c;
+    std::set<int> expected;
+    auto hint = c.end_left();
+    for (int i = 0; i < 3000; i++) {
+        int key = i % 1000 < 500 ? i : 10000 - i;
+        auto it = c.insert(hint, key, -key);
+        EXPECT_EQ(it == c.end_left(), !expected.insert(key).second);
+        hint = it == c.end_left() ? c.find_left(key) : it;
+    }
+    for (int i = 0; i < 3000; i++) {
+        int key = static_cast<int>(e() % 20000);
+        auto it = c.insert(c.lower_bound_left(static_cast<int>(e() % 20000)), key, -key);
+        EXPECT_EQ(it == c.end_left(), !expected.insert(key).second);
+    }
+    EXPECT_EQ(c.insert(c.begin_left(), 20001, -2), c.end_left());
+    EXPECT_EQ(c.size(), expected.size());
+    EXPECT_TRUE(std::equal(c.begin_left(), c.end_left(), expected.begin(), expected.end()));
+    for (int key : expected) {
+        EXPECT_EQ(c.at_right(-key), key);
+    }
+}
+
+// Appends by hinted inserts after all kinds of changes: the cached maximum of each side has to stay right
+template<typename Policy>
+void check_appends() {
+    using bm = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<int>, Policy>;
+    std::mt19937 e(1488228);
+    bm b;
+    std::set<int> expected;
+    auto append = [&](bm &t, std::set<int> &keys) {
+        int key = keys.empty() ? 0 : *keys.rbegin() + 1 + static_cast<int>(e() % 3);
+        auto hint = e() % 2 == 0 || t.empty() ? t.end_left() : std::prev(t.end_left());
+        EXPECT_NE(t.insert(hint, key, -key), t.end_left());
+        keys.insert(key);
+    };
+    for (int round = 0; round < 300; round++) {
+        for (int i = 0; i < 20; i++) {
+            append(b, expected);
+        }
+        int key = *std::next(expected.begin(), static_cast<long>(e() % expected.size()));
+        switch (e() % 8) {
+            case 0:
+                b.erase_left(*expected.rbegin());
+                expected.erase(std::prev(expected.end()));
+                break;
+            case 1:
+                b.erase_right(-*expected.rbegin());
+                expected.erase(std::prev(expected.end()));
+                break;
+            case 2:
+                b.erase_left(b.lower_bound_left(key), b.end_left());
+                expected.erase(expected.lower_bound(key), expected.end());
+                break;
+            case 3:
+                b.insert(b.extract_left(*expected.rbegin()));
+                break;
+            case 4: {
+                bm other;
+                std::set<int> other_keys = expected;
+                for (int i = 0; i < 10; i++) {
+                    append(other, other_keys);
+                }
+                for (int k : expected) {
+                    other.erase_left(k);
+                }
+                b.merge(std::move(other));
+                expected = other_keys;
+                break;
+            }
+            case 5: {
+                bm moved(std::move(b));
+                b = bm(moved);
+                break;
+            }
+            case 6: {
+                bm other;
+                b.swap(other);
+                b = std::move(other);
+                break;
+            }
+            default:
+                if (e() % 8 == 0) {
+                    b.clear();
+                    expected.clear();
+                } else {
+                    b.erase_left(key);
+                    expected.erase(key);
+                }
+        }
+        ASSERT_TRUE(std::equal(b.begin_left(), b.end_left(), expected.begin(), expected.end()));
+    }
+    for (int key : expected) {
+        EXPECT_EQ(b.at_right(-key), key);
+    }
+}
+
+TEST(bimap, appends) {
+    check_appends<intrusive::default_policy>();
+    check_appends<intrusive::order_statistics_policy>();
+    check_appends<intrusive::wavl_policy>();
+}
+
+// A sorted run hinted by the previous insertion compares each key once on a side and never descends
+template<typename Policy>
+void check_sorted_run_comparisons() {
+    using bm = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<int>, Policy>;
+    bm b;
+    std::size_t n = 20000;
+    auto hint = b.end_left();
+    for (std::size_t i = 0; i < n; i++) {
+        hint = b.insert(hint, static_cast<int>(i), static_cast<int>(2 * i));
+    }
+    EXPECT_EQ(b.size(), n);
+    EXPECT_EQ(b.statistics().left.comparisons, n - 1);
+    EXPECT_EQ(b.statistics().right.comparisons, n - 1);
+    // Sorted keys hinted by end_left()
+    bm c;
+    for (std::size_t i = 0; i < n; i++) {
+        c.insert(c.end_left(), static_cast<int>(i), -static_cast<int>(i));
+    }
+    EXPECT_EQ(c.statistics().left.comparisons, n - 1);
+    EXPECT_TRUE(std::is_sorted(c.begin_left(), c.end_left()));
+}
+
+namespace {
+    struct wavl_statistics : intrusive::wavl_policy {
+        static constexpr bool statistics = true;
+    };
+}
+
+TEST(bimap, sorted_run_comparisons) {
+    check_sorted_run_comparisons<intrusive::statistics_policy>();
+    check_sorted_run_comparisons<wavl_statistics>();
+}
+
+TEST(bimap, finger_search) {
+    check_finger_search<intrusive::default_policy>();
+    check_finger_search<intrusive::order_statistics_policy>();
+    check_finger_search<intrusive::wavl_policy>();
+}
+
+TEST(bimap, range) {
+    bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<std::pair<int, int>>,
+            intrusive::order_statistics_policy> b;
+    for (int i = 0; i < 50; i++) {
+        b.insert(2 * i, -i);
+    }
+
+    std::vector<int> lefts;
+    for (int l : b.range_left(9, 20)) {
+        lefts.push_back(l);
+    }
+    EXPECT_EQ(lefts, (std::vector<int>{10, 12, 14, 16, 18}));
+    EXPECT_EQ(b.count_range_left(9, 20), 5);
+    EXPECT_EQ(b.count_range_left(10, 20), 5);
+    EXPECT_EQ(b.count_range_left(-100, 100), 50);
+
+    auto rights = b.range_right(-3, 0);
+    EXPECT_EQ(*rights.begin(), -3);
+    EXPECT_EQ(*rights.begin().flip(), 6);
+    EXPECT_EQ(std::distance(rights.begin(), rights.end()), 3);
+    EXPECT_EQ(b.count_range_right(-3, 0), 3);
+
+    EXPECT_TRUE(b.range_left(20, 9).empty());
+    EXPECT_TRUE(b.range_left(5, 5).empty());
+    EXPECT_TRUE(b.range_right(100, 200).empty());
+    EXPECT_EQ(b.count_range_left(20, 9), 0);
+    EXPECT_EQ(b.count_range_right(100, 200), 0);
+
+    bimap<int, int> plain;
+    plain.insert(1, 2);
+    EXPECT_EQ(*plain.range_left(0, 5).begin(), 1);
+}
+
 TEST(bimap, upper_bound) {
     bimap<int, int> b;
 
@@ -294,6 +1121,112 @@ TEST(bimap, upper_bound) {
     EXPECT_EQ(b.upper_bound_left(400), b.end_left());
 }
 
+TEST(bimap, range_constructor) {
+    std::vector<std::pair<int, int>> data = {
+            {5, 1},
+            {3, 2},
+            {5, 3},
+            {4, 2},
+            {1, 7},
+            {2, 4}};
+
+    bimap<int, int> b(data.begin(), data.end());
+    bimap<int, int> expected;
+    for (auto const &p: data) {
+        expected.insert(p.first, p.second);
+    }
+    EXPECT_EQ(b.size(), 4);
+    EXPECT_EQ(b, expected);
+    EXPECT_EQ(b.at_left(5), 1);
+    EXPECT_EQ(b.find_left(4), b.end_left());
+}
+
+TEST(bimap, from_sorted_left) {
+    std::vector<std::pair<int, int>> data;
+    std::mt19937 e(42);
+    for (int i = 0; i < 1000; i++) {
+        data.emplace_back(i / 2, static_cast<int>(e() % 700));
+    }
+
+    auto b = bimap<int, int>::from_sorted_left(data.begin(), data.end());
+    bimap<int, int> expected;
+    for (auto const &p: data) {
+        expected.insert(p.first, p.second);
+    }
+    EXPECT_EQ(b.size(), expected.size());
+    EXPECT_EQ(b, expected);
+    for (auto it = expected.begin_right(); it != expected.end_right(); ++it) {
+        EXPECT_EQ(b.at_right(*it), *it.flip());
+    }
+
+    b.insert(10000, 10000);
+    EXPECT_TRUE(b.erase_left(0));
+    EXPECT_EQ(b.size(), expected.size());
+}
+
+TEST(bimap, save_load) {
+    bimap<int, double> b;
+    std::mt19937 e(42);
+    for (int i = 0; i < 1000; i++) {
+        b.insert(static_cast<int>(e() % 5000), static_cast<double>(e() % 5000) / 4);
+    }
+    std::stringstream image;
+    b.save(image);
+    auto loaded = bimap<int, double>::load(image);
+    EXPECT_EQ(loaded, b);
+    for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+        EXPECT_EQ(loaded.at_right(*it), *it.flip());
+    }
+    auto inserted = loaded.insert(-1, -1.0);
+    EXPECT_EQ(inserted, loaded.find_left(-1));
+    EXPECT_EQ(loaded.begin_right().flip(), inserted);
+
+    std::stringstream empty;
+    bimap<int, double>().save(empty);
+    EXPECT_TRUE((bimap<int, double>::load(empty).empty()));
+
+    std::string bytes = image.str();
+    std::istringstream truncated(bytes.substr(0, bytes.size() - 1));
+    EXPECT_THROW((bimap<int, double>::load(truncated)), std::runtime_error);
+    std::istringstream other_types(bytes);
+    EXPECT_THROW((bimap<int, float>::load(other_types)), std::runtime_error);
+    bytes[0] = 'B';
+    std::istringstream bad_magic(bytes);
+    EXPECT_THROW((bimap<int, double>::load(bad_magic)), std::runtime_error);
+}
+
+namespace {
+    // A stream buffer which cannot seek, like a pipe.
+    struct forward_only_buf : std::streambuf {
+        explicit forward_only_buf(std::string &bytes) {
+            setg(bytes.data(), bytes.data(), bytes.data() + bytes.size());
+        }
+    };
+}
+
+TEST(bimap, load_forged_count) {
+    bimap<int, double> b;
+    for (int i = 0; i < 100; i++) {
+        b.insert(i, i / 2.0);
+    }
+    std::stringstream image;
+    b.save(image);
+    std::string bytes = image.str();
+    std::uint64_t forged = std::numeric_limits<std::uint32_t>::max();
+    std::memcpy(&bytes[offsetof(intrusive::image_header, count)], &forged, sizeof(forged));
+
+    std::istringstream seekable(bytes);
+    EXPECT_THROW((bimap<int, double>::load(seekable)), std::runtime_error);
+    forward_only_buf buf(bytes);
+    std::istream pipe(&buf);
+    EXPECT_THROW((bimap<int, double>::load(pipe)), std::runtime_error);
+
+    std::string valid = image.str();
+    forward_only_buf valid_buf(valid);
+    std::istream valid_pipe(&valid_buf);
+    EXPECT_EQ((bimap<int, double>::load(valid_pipe)), b);
+}
+
 template<typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T> &lefts, std::vector<T> &rights, std::mt19937 &e) {
@@ -344,6 +1277,280 @@ struct bimap<non_default_constructible, int>;
 
 static constexpr uint32_t seed = 1488228;
 
+namespace {
+    // Pairs of b in left order
+    template<typename BM>
+    std::vector<std::pair<int, int>> pairs_of(BM const &b) {
+        std::vector<std::pair<int, int>> res;
+        for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+            res.emplace_back(*it, *it.flip());
+        }
+        return res;
+    }
+
+    // Merges random bimaps and compares the result with inserting pairs one by one
+    template<typename BM>
+    void check_merge(std::size_t n, std::size_t m, int range, std::size_t threads, bool share_pool = false) {
+        std::mt19937 e(seed);
+        BM a, b, expected;
+        while (a.size() < n) {
+            int l = static_cast<int>(e() % range), r = static_cast<int>(e() % range);
+            a.insert(l, r);
+            expected.insert(l, r);
+        }
+        while (b.size() < m) {
+            b.insert(static_cast<int>(e() % range), static_cast<int>(e() % range));
+        }
+        for (auto const &p : pairs_of(b)) {
+            expected.insert(p.first, p.second);
+        }
+        auto pool_user = b.get_allocator();
+        if (!share_pool) {
+            pool_user = decltype(pool_user)();
+        }
+        a.merge(std::move(b), threads);
+        EXPECT_TRUE(b.empty());
+        EXPECT_EQ(b.begin_left(), b.end_left());
+        ASSERT_EQ(a.size(), expected.size());
+        EXPECT_EQ(pairs_of(a), pairs_of(expected));
+        auto r = a.begin_right();
+        for (auto it = expected.begin_right(); it != expected.end_right(); ++it, ++r) {
+            EXPECT_EQ(*r, *it);
+        }
+        // Both bimaps stay usable
+        b.insert(1, 1);
+        a.erase_left(a.begin_left(), a.end_left());
+        EXPECT_TRUE(a.empty());
+    }
+}
+
+TEST(bimap, merge) {
+    bimap<int, int> a, b;
+    a.insert(1, 10);
+    a.insert(2, 20);
+    b.insert(1, 30);
+    b.insert(3, 20);
+    b.insert(4, 40);
+    a.merge(std::move(b));
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(a.size(), 3);
+    EXPECT_EQ(a.at_left(1), 10);
+    EXPECT_EQ(a.at_right(20), 2);
+    EXPECT_EQ(a.at_left(4), 40);
+    a.merge(std::move(a));
+    EXPECT_EQ(a.size(), 3);
+}
+
+TEST(bimap, merge_randomized) {
+    using plain = bimap<int, int, std::less<int>, std::less<int>, std::allocator<std::pair<int, int>>>;
+    using counted = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<std::pair<int, int>>,
+            intrusive::order_statistics_policy>;
+    check_merge<bimap<int, int>>(1000, 1000, 3000, 1);
+    check_merge<bimap<int, int>>(1000, 10, 3000, 1);
+    check_merge<bimap<int, int>>(10, 1000, 3000, 1);
+    check_merge<bimap<int, int>>(1000, 1000, 3000, 1, true);
+    check_merge<plain>(1000, 1000, 3000, 1);
+    check_merge<bimap<int, int>>(30000, 30000, 100000, 8);
+    check_merge<counted>(30000, 30000, 100000, 4);
+    check_merge<bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<int>,
+            intrusive::wavl_policy>>(30000, 30000, 100000, 8);
+
+    counted a, b;
+    for (int i = 0; i < 100; i++) {
+        (i % 2 == 0 ? a : b).insert(i, -i);
+    }
+    a.merge(std::move(b));
+    for (std::size_t i = 0; i < 100; i++) {
+        EXPECT_EQ(*a.nth_left(i), i);
+        EXPECT_EQ(a.rank_right(-static_cast<int>(i)), 99 - i);
+    }
+}
+
+template<typename Policy = intrusive::fingerprint_policy, typename Bimap>
+std::uint64_t recomputed_fingerprint(Bimap const &b) {
+    std::uint64_t res = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+        res += intrusive::pair_hash<Policy>(*it, *it.flip());
+    }
+    return res;
+}
+
+TEST(bimap, fingerprint) {
+    using bm = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<int>,
+            intrusive::fingerprint_policy>;
+    std::mt19937 e(1488228);
+    bm a, b;
+    EXPECT_EQ(a.fingerprint(), 0);
+    for (int i = 0; i < 1000; i++) {
+        int l = static_cast<int>(e() % 3000), r = static_cast<int>(e() % 3000);
+        a.insert(l, r);
+        b.insert(b.lower_bound_left(l), l, r);
+    }
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a.fingerprint(), b.fingerprint());
+    EXPECT_EQ(a.fingerprint(), recomputed_fingerprint(a));
+
+    // The same pair through other paths
+    int l = *std::next(a.begin_left(), 10), r = *std::next(a.begin_left(), 10).flip();
+    b.erase_left(l);
+    EXPECT_NE(a.fingerprint(), b.fingerprint());
+    EXPECT_FALSE(a == b);
+    b.try_emplace_left(l, r);
+    EXPECT_EQ(a.fingerprint(), b.fingerprint());
+    b.insert(b.extract_right(r));
+    b.erase_right(b.find_right(r));
+    b.emplace(std::piecewise_construct, std::forward_as_tuple(l), std::forward_as_tuple(r));
+    EXPECT_EQ(a.fingerprint(), b.fingerprint());
+    EXPECT_EQ(b.fingerprint(), recomputed_fingerprint(b));
+
+    b.erase_left(std::next(b.begin_left(), 100), std::next(b.begin_left(), 300));
+    EXPECT_EQ(b.fingerprint(), recomputed_fingerprint(b));
+    bm c;
+    for (int i = 0; i < 500; i++) {
+        c.insert(static_cast<int>(e() % 3000), static_cast<int>(e() % 3000));
+    }
+    b.merge(std::move(c));
+    EXPECT_EQ(c.fingerprint(), 0);
+    EXPECT_EQ(b.fingerprint(), recomputed_fingerprint(b));
+    bm other_pool;
+    other_pool.insert(-1, -1);
+    c = bm(std::less<int>(), std::less<int>(), intrusive::slab_allocator<int>());
+    c.insert(-2, -2);
+    b.merge(std::move(other_pool));
+    EXPECT_EQ(b.fingerprint(), recomputed_fingerprint(b));
+
+    bm copy = b;
+    EXPECT_EQ(copy.fingerprint(), b.fingerprint());
+    bm moved = std::move(copy);
+    EXPECT_EQ(moved.fingerprint(), b.fingerprint());
+    EXPECT_EQ(copy.fingerprint(), 0);
+    moved.swap(c);
+    EXPECT_EQ(c.fingerprint(), b.fingerprint());
+    EXPECT_EQ(moved.fingerprint(), recomputed_fingerprint(moved));
+
+    std::vector<std::pair<int, int>> pairs;
+    for (auto it = a.begin_left(); it != a.end_left(); ++it) {
+        pairs.emplace_back(*it, *it.flip());
+    }
+    pairs.emplace_back(pairs.front().first, 100000);
+    std::shuffle(pairs.begin(), pairs.end() - 1, e);
+    bm built(pairs.begin(), pairs.end());
+    EXPECT_EQ(built.fingerprint(), a.fingerprint());
+    std::stringstream image;
+    a.save(image);
+    EXPECT_EQ(bm::load(image).fingerprint(), a.fingerprint());
+
+    a.clear();
+    EXPECT_EQ(a.fingerprint(), 0);
+}
+
+struct case_insensitive_less {
+    bool operator()(std::string const &a, std::string const &b) const {
+        return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+            return std::tolower(static_cast<unsigned char>(x)) < std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+};
+
+struct case_insensitive_hash {
+    std::size_t operator()(std::string s) const {
+        for (char &c : s) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        return std::hash<std::string>()(s);
+    }
+};
+
+struct case_insensitive_policy : intrusive::fingerprint_policy {
+    template<typename Key>
+    using fingerprint_hash = std::conditional_t<std::is_same_v<Key, std::string>, case_insensitive_hash,
+            std::hash<Key>>;
+    static constexpr bool fingerprint_hash_exact = true;
+};
+
+TEST(bimap, fingerprint_custom_comparator) {
+    // std::hash does not agree with the comparator, so fingerprints may differ for equal bimaps
+    using by_std_hash = bimap<std::string, int, case_insensitive_less, std::less<int>,
+            intrusive::slab_allocator<std::string>, intrusive::fingerprint_policy>;
+    by_std_hash a, b;
+    a.insert("Alice", 1);
+    a.insert("bob", 2);
+    b.insert("alice", 1);
+    b.insert("BOB", 2);
+    EXPECT_NE(a.fingerprint(), b.fingerprint());
+    EXPECT_EQ(a, b);
+    b.erase_left("ALICE");
+    b.insert("Carol", 1);
+    EXPECT_NE(a, b);
+
+    using by_own_hash = bimap<std::string, int, case_insensitive_less, std::less<int>,
+            intrusive::slab_allocator<std::string>, case_insensitive_policy>;
+    by_own_hash c, d;
+    c.insert("Alice", 1);
+    c.insert("bob", 2);
+    d.insert("alice", 1);
+    d.insert("BOB", 2);
+    EXPECT_EQ(c.fingerprint(), d.fingerprint());
+    EXPECT_EQ(c.fingerprint(), recomputed_fingerprint<case_insensitive_policy>(c));
+    EXPECT_EQ(c, d);
+    d.erase_right(1);
+    d.insert("Carol", 1);
+    EXPECT_NE(c.fingerprint(), d.fingerprint());
+    EXPECT_NE(c, d);
+}
+
+TEST(bimap, equality_blocks) {
+    // Around the block size
+    for (int n : {1, 63, 64, 65, 129}) {
+        bimap<int, long long> a, b;
+        for (int i = 0; i < n; i++) {
+            a.insert(i, -i);
+            b.insert(n - 1 - i, -(n - 1 - i));
+        }
+        EXPECT_EQ(a, b);
+        b.erase_left(n - 1);
+        b.insert(n - 1, 1);
+        EXPECT_NE(a, b);
+    }
+
+    bimap<unsigned, char> a, b;
+    for (unsigned i = 0; i < 100; i++) {
+        a.insert(i, static_cast<char>(i));
+        b.insert(99 - i, static_cast<char>(99 - i));
+    }
+    b.erase_left(99);
+    b.insert(99, 100);
+    EXPECT_NE(a, b);
+    b.erase_left(99);
+    b.insert(100, 99);
+    EXPECT_NE(a, b);
+    b.erase_left(100);
+    b.insert(99, 99);
+    EXPECT_EQ(a, b);
+
+    bimap<int, int, std::greater<int>, std::less<>> c, d;
+    for (int i = 0; i < 100; i++) {
+        c.insert(i, i);
+        d.insert(i, i + (i == 64));
+    }
+    EXPECT_NE(c, d);
+
+    // Floating point keys go through the comparators, -0.0 is equivalent to 0.0
+    bimap<int, double> f, g;
+    for (int i = 0; i < 100; i++) {
+        f.insert(i, i / 2.0);
+        g.insert(i, i == 0 ? -0.0 : i / 2.0);
+    }
+    EXPECT_EQ(f, g);
+    g.erase_left(99);
+    g.insert(99, 0.25);
+    EXPECT_NE(f, g);
+
+    static_assert(intrusive::plain_equality<int, std::less<>> && intrusive::plain_equality<char, std::greater<char>>);
+    static_assert(!intrusive::plain_equality<double, std::less<>> &&
+                  !intrusive::plain_equality<int, std::less_equal<int>>);
+}
+
 TEST(bimap_randomized, comparison) {
     std::cout << "Seed used for randomized compare test is " << seed << std::endl;
 
@@ -461,3 +1668,513 @@ TEST(bimap_randomized, compare_to_two_maps) {
     std::cout << "Performed " << ins << " insertions and " << total - ins - skip
               << " erasures. " << skip << " skipped." << std::endl;
 }
+
+TEST(hash_bimap, simple) {
+    hash_bimap<int, std::string> b;
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(b.end_left().flip(), b.end_right());
+    EXPECT_EQ(b.find_left(1), b.end_left());
+
+    EXPECT_EQ(*b.insert(1, "one"), 1);
+    EXPECT_EQ(*b.insert(2, "two").flip(), "two");
+    EXPECT_EQ(b.insert(1, "uno"), b.end_left());
+    EXPECT_EQ(b.insert(3, "two"), b.end_left());
+    EXPECT_EQ(b.size(), 2);
+
+    EXPECT_EQ(b.at_left(1), "one");
+    EXPECT_EQ(b.at_right("two"), 2);
+    EXPECT_THROW(b.at_left(3), std::out_of_range);
+    EXPECT_EQ(b.find_right("one").flip(), b.find_left(1));
+    EXPECT_EQ(b.find_left(2).flip()->size(), 3);
+
+    EXPECT_EQ(b.at_left_or_default(3), "");
+    EXPECT_EQ(b.at_right_or_default("four"), 0);
+    EXPECT_EQ(b.at_right(""), 3);
+    EXPECT_EQ(b.size(), 4);
+
+    EXPECT_TRUE(b.erase_right("four"));
+    EXPECT_FALSE(b.erase_left(0));
+    EXPECT_EQ(b.size(), 3);
+}
+
+TEST(hash_bimap, iteration_and_rehash) {
+    hash_bimap<int, int> b;
+    for (int i = 0; i < 1000; i++) {
+        b.insert(i, -i);
+    }
+    EXPECT_GE(b.bucket_count(), b.size());
+
+    std::vector<int> lefts(b.begin_left(), b.end_left());
+    std::sort(lefts.begin(), lefts.end());
+    ASSERT_EQ(lefts.size(), 1000);
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(lefts[i], i);
+    }
+    for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+        EXPECT_EQ(*it.flip(), -*it);
+        EXPECT_EQ(it.flip().flip(), it);
+    }
+
+    for (auto it = b.begin_left(); it != b.end_left();) {
+        it = *it % 2 == 0 ? b.erase_left(it) : std::next(it);
+    }
+    EXPECT_EQ(b.size(), 500);
+    EXPECT_EQ(b.find_right(-2), b.end_right());
+    EXPECT_EQ(b.at_right(-3), 3);
+}
+
+TEST(hash_bimap, copies) {
+    hash_bimap<int, int> b;
+    for (int i = 0; i < 100; i++) {
+        b.insert(i, i * 7);
+    }
+    hash_bimap<int, int> copy = b;
+    EXPECT_EQ(copy, b);
+    copy.erase_left(5);
+    EXPECT_NE(copy, b);
+    copy.insert(5, 1);
+    EXPECT_NE(copy, b);
+
+    hash_bimap<int, int> moved = std::move(copy);
+    EXPECT_TRUE(copy.empty());
+    EXPECT_EQ(moved.size(), 100);
+    EXPECT_EQ(moved.end_right().flip(), moved.end_left());
+    // The moved-from hash_bimap does not share the slab pool of the moved-to one
+    copy.insert(1, 1);
+    EXPECT_FALSE(copy.get_allocator() == moved.get_allocator());
+    copy = moved;
+    EXPECT_EQ(copy, moved);
+
+    std::vector<std::pair<int, int>> pairs = {{1, 2}, {3, 4}, {1, 5}, {6, 4}};
+    hash_bimap<int, int> from_range(pairs.begin(), pairs.end());
+    EXPECT_EQ(from_range.size(), 2);
+    EXPECT_EQ(from_range.at_left(1), 2);
+    EXPECT_EQ(from_range.at_right(4), 3);
+}
+
+TEST(hash_bimap_randomized, compare_to_bimap) {
+    hash_bimap<int, int> h;
+    bimap<int, int> b;
+    std::mt19937 e(seed);
+    for (size_t i = 0; i < 60000; i++) {
+        int l = static_cast<int>(e() % 5000), r = static_cast<int>(e() % 5000);
+        if (e() % 3 != 0) {
+            EXPECT_EQ(h.insert(l, r) == h.end_left(), b.insert(l, r) == b.end_left());
+        } else {
+            EXPECT_EQ(h.erase_right(r), b.erase_right(r));
+        }
+        if (i % 1000 == 0) {
+            ASSERT_EQ(h.size(), b.size());
+            for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+                EXPECT_EQ(h.at_left(*it), *it.flip());
+            }
+        }
+    }
+}
+
+TEST(concurrent_bimap, simple) {
+    concurrent_bimap<int, std::string> b;
+    EXPECT_TRUE(b.empty());
+    EXPECT_TRUE(b.insert(1, "one"));
+    EXPECT_TRUE(b.insert(2, "two"));
+    EXPECT_FALSE(b.insert(1, "uno"));
+    EXPECT_FALSE(b.insert(3, "two"));
+    EXPECT_EQ(b.size(), 2);
+
+    EXPECT_EQ(b.at_left(1), "one");
+    EXPECT_EQ(b.at_right("two"), 2);
+    EXPECT_EQ(b.find_left(3), std::nullopt);
+    EXPECT_THROW(b.at_right("three"), std::out_of_range);
+
+    EXPECT_TRUE(b.erase_right("one"));
+    EXPECT_FALSE(b.erase_left(1));
+    EXPECT_EQ(b.find_right("one"), std::nullopt);
+    EXPECT_EQ(b.size(), 1);
+    b.synchronize();
+    EXPECT_EQ(b.at_left(2), "two");
+}
+
+// Key which counts its copies, moves are free
+struct copy_counted {
+    static inline std::size_t copies = 0;
+
+    int a;
+
+    explicit copy_counted(int a) : a(a) {}
+
+    copy_counted(copy_counted const &other) : a(other.a) { copies++; }
+
+    copy_counted(copy_counted &&other) noexcept = default;
+
+    friend bool operator<(copy_counted const &c, copy_counted const &b) {
+        return c.a < b.a;
+    }
+};
+
+TEST(concurrent_bimap, insert_copies) {
+    // Empty bimaps, so that no old node is copied along the path
+    concurrent_bimap<copy_counted, copy_counted> a, b;
+    copy_counted left(1), right(2);
+    copy_counted::copies = 0;
+    // One copy per side for both keys, the nodes take the keys of the protos
+    EXPECT_TRUE(a.insert(left, right));
+    EXPECT_EQ(copy_counted::copies, 4);
+    copy_counted::copies = 0;
+    EXPECT_TRUE(b.insert(copy_counted(3), copy_counted(4)));
+    EXPECT_EQ(copy_counted::copies, 2);
+}
+
+TEST(concurrent_bimap, readers_during_writes) {
+    concurrent_bimap<int, int> b;
+    std::atomic<bool> done{false};
+    std::atomic<std::size_t> inconsistent{0};
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&, t] {
+            std::mt19937 e(static_cast<std::uint32_t>(t));
+            while (!done.load()) {
+                int k = static_cast<int>(e() % 2000);
+                auto r = b.find_left(k);
+                auto l = b.find_right(-k);
+                if ((r && *r != -k) || (l && *l != k)) {
+                    inconsistent++;
+                }
+            }
+        });
+    }
+
+    std::mt19937 e(seed);
+    std::set<int> keys;
+    for (size_t i = 0; i < 20000; i++) {
+        int k = static_cast<int>(e() % 2000);
+        if (e() % 2 == 0) {
+            EXPECT_EQ(b.insert(k, -k), keys.insert(k).second);
+        } else {
+            EXPECT_EQ(b.erase_left(k), keys.erase(k) == 1);
+        }
+    }
+    done = true;
+    for (auto &r : readers) {
+        r.join();
+    }
+    EXPECT_EQ(inconsistent.load(), 0);
+    EXPECT_EQ(b.size(), keys.size());
+    for (int k : keys) {
+        EXPECT_EQ(b.at_right(-k), k);
+    }
+}
+
+TEST(persistent_bimap, versions) {
+    persistent_bimap<int, std::string> empty;
+    auto one = empty.insert(1, "one");
+    auto two = one.insert(2, "two");
+    auto same = two.insert(3, "two");
+
+    EXPECT_TRUE(empty.empty());
+    EXPECT_EQ(one.size(), 1);
+    EXPECT_EQ(two.size(), 2);
+    EXPECT_EQ(same, two);
+    EXPECT_EQ(one.find_left(2), one.end_left());
+    EXPECT_EQ(two.at_left(2), "two");
+    EXPECT_EQ(two.at_right("one"), 1);
+    EXPECT_EQ(two.find_right("two").opposite(), 2);
+    EXPECT_THROW(one.at_right("two"), std::out_of_range);
+
+    auto erased = two.erase_right("one");
+    EXPECT_EQ(erased.size(), 1);
+    EXPECT_EQ(erased.find_left(1), erased.end_left());
+    EXPECT_EQ(two.at_left(1), "one");
+    EXPECT_EQ(erased.erase_left(5), erased);
+
+    persistent_bimap<int, std::string> snapshot = two;
+    two = two.erase_left(2).erase_left(1);
+    EXPECT_TRUE(two.empty());
+    EXPECT_EQ(snapshot.size(), 2);
+    EXPECT_EQ(*snapshot.begin_right(), "one");
+}
+
+TEST(persistent_bimap, insert_copies) {
+    persistent_bimap<copy_counted, copy_counted> empty;
+    copy_counted left(1), right(2);
+    copy_counted::copies = 0;
+    auto one = empty.insert(left, right);
+    EXPECT_EQ(copy_counted::copies, 4);
+    copy_counted::copies = 0;
+    auto other = empty.insert(copy_counted(3), copy_counted(4));
+    EXPECT_EQ(copy_counted::copies, 2);
+}
+
+TEST(persistent_bimap, concurrent_versions) {
+    persistent_bimap<int, int> base;
+    for (int i = 0; i < 1000; i++) {
+        base = base.insert(i, -i);
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; t++) {
+        workers.emplace_back([&base, t] {
+            persistent_bimap<int, int> own = base;
+            for (int i = 0; i < 1000; i++) {
+                own = own.erase_left(i).insert(i, 1000 * (t + 1) + i);
+            }
+            EXPECT_EQ(own.at_left(999), 1000 * (t + 1) + 999);
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    EXPECT_EQ(base.at_left(999), -999);
+}
+
+TEST(persistent_bimap_randomized, compare_history) {
+    std::mt19937 e(seed);
+    std::vector<persistent_bimap<int, int>> versions(1);
+    std::vector<std::map<int, int>> expected(1);
+    for (size_t i = 0; i < 3000; i++) {
+        // Every update starts from a random older version
+        std::size_t from = e() % versions.size();
+        int l = static_cast<int>(e() % 500), r = static_cast<int>(e() % 500);
+        std::map<int, int> m = expected[from];
+        if (e() % 3 != 0) {
+            versions.push_back(versions[from].insert(l, r));
+            bool right_exists = std::any_of(m.begin(), m.end(), [r](auto const &p) { return p.second == r; });
+            if (!right_exists) {
+                m.insert({l, r});
+            }
+        } else {
+            versions.push_back(versions[from].erase_left(l));
+            m.erase(l);
+        }
+        expected.push_back(std::move(m));
+        if (e() % 4 == 0) {
+            std::size_t dropped = e() % versions.size();
+            versions[dropped] = versions.back();
+            expected[dropped] = expected.back();
+        }
+    }
+    for (std::size_t v = 0; v < versions.size(); v++) {
+        ASSERT_EQ(versions[v].size(), expected[v].size());
+        auto it = versions[v].begin_left();
+        for (auto const &p : expected[v]) {
+            EXPECT_EQ(*it, p.first);
+            EXPECT_EQ(it.opposite(), p.second);
+            EXPECT_EQ(versions[v].at_right(p.second), p.first);
+            ++it;
+        }
+        EXPECT_EQ(it, versions[v].end_left());
+    }
+}
+
+TEST(flat_bimap, simple) {
+    flat_bimap<int, std::string> b;
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(b.end_left().flip(), b.end_right());
+    EXPECT_EQ(*b.insert(5, "five"), 5);
+    EXPECT_EQ(*b.insert(1, "one").flip(), "one");
+    EXPECT_EQ(b.insert(1, "uno"), b.end_left());
+    EXPECT_EQ(b.insert(3, "one"), b.end_left());
+    EXPECT_EQ(*b.insert(3, "three").flip(), "three");
+
+    EXPECT_EQ(b.size(), 3);
+    EXPECT_EQ(b.at_left(3), "three");
+    EXPECT_EQ(b.at_right("five"), 5);
+    EXPECT_THROW(b.at_left(4), std::out_of_range);
+    EXPECT_EQ(*b.lower_bound_left(2), 3);
+    EXPECT_EQ(*b.upper_bound_left(3), 5);
+    EXPECT_EQ(b.upper_bound_right("three"), b.end_right());
+    EXPECT_EQ(b.end_left() - b.begin_left(), 3);
+    EXPECT_EQ(b.begin_right()[2], "three");
+    EXPECT_EQ(b.find_right("one").flip(), b.begin_left());
+
+    EXPECT_EQ(*b.erase_left(b.find_left(3)), 5);
+    EXPECT_TRUE(b.erase_right("one"));
+    EXPECT_FALSE(b.erase_left(1));
+    EXPECT_EQ(b.size(), 1);
+    EXPECT_EQ(b.at_left(5), "five");
+}
+
+TEST(flat_bimap_randomized, compare_to_bimap) {
+    std::mt19937 e(seed);
+    std::vector<std::pair<int, int>> pairs;
+    for (int i = 0; i < 3000; i++) {
+        pairs.emplace_back(static_cast<int>(e() % 2000), static_cast<int>(e() % 2000));
+    }
+    flat_bimap<int, int> f(pairs.begin(), pairs.end());
+    bimap<int, int> b(pairs.begin(), pairs.end());
+
+    auto check = [&] {
+        ASSERT_EQ(f.size(), b.size());
+        auto it = f.begin_left();
+        for (auto jt = b.begin_left(); jt != b.end_left(); ++jt, ++it) {
+            EXPECT_EQ(*it, *jt);
+            EXPECT_EQ(*it.flip(), *jt.flip());
+            EXPECT_EQ(it.flip().flip(), it);
+        }
+        auto rt = f.begin_right();
+        for (auto jt = b.begin_right(); jt != b.end_right(); ++jt, ++rt) {
+            EXPECT_EQ(*rt, *jt);
+            EXPECT_EQ(*rt.flip(), *jt.flip());
+        }
+    };
+    check();
+
+    for (int i = 0; i < 300; i++) {
+        int l = static_cast<int>(e() % 2000), r = static_cast<int>(e() % 2000);
+        if (e() % 2 == 0) {
+            EXPECT_EQ(f.insert(l, r) == f.end_left(), b.insert(l, r) == b.end_left());
+        } else {
+            EXPECT_EQ(f.erase_right(r), b.erase_right(r));
+        }
+    }
+    check();
+
+    std::vector<std::pair<int, int>> batch;
+    for (int i = 0; i < 2000; i++) {
+        batch.emplace_back(static_cast<int>(e() % 4000), static_cast<int>(e() % 4000));
+    }
+    std::size_t inserted = 0;
+    for (auto const &p : batch) {
+        inserted += b.insert(p.first, p.second) != b.end_left();
+    }
+    EXPECT_EQ(f.insert_batch(batch.begin(), batch.end()), inserted);
+    check();
+
+    EXPECT_EQ(f.erase_left_if([](int l) { return l % 3 == 0; }),
+              std::count_if(b.begin_left(), b.end_left(), [](int l) { return l % 3 == 0; }));
+    for (auto it = b.begin_left(); it != b.end_left();) {
+        it = *it % 3 == 0 ? b.erase_left(it) : std::next(it);
+    }
+    check();
+}
+
+TEST(mapped_bimap, compare_to_bimap) {
+    bimap<int, int> b;
+    std::mt19937 e(seed);
+    for (int i = 0; i < 3000; i++) {
+        b.insert(static_cast<int>(e() % 10000), static_cast<int>(e() % 10000));
+    }
+    std::string path = testing::TempDir() + "mapped_bimap_test.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        b.save(out);
+    }
+    mapped_bimap<int, int> m(path);
+    ASSERT_EQ(m.size(), b.size());
+    auto it = m.begin_left();
+    for (auto jt = b.begin_left(); jt != b.end_left(); ++jt, ++it) {
+        EXPECT_EQ(*it, *jt);
+        EXPECT_EQ(*it.flip(), *jt.flip());
+        EXPECT_EQ(m.find_right(*jt.flip()), it.flip());
+    }
+    EXPECT_EQ(it, m.end_left());
+    for (int i = 0; i < 1000; i++) {
+        int k = static_cast<int>(e() % 10000);
+        EXPECT_EQ(m.find_left(k) == m.end_left(), b.find_left(k) == b.end_left());
+        EXPECT_EQ(m.lower_bound_right(k).index(),
+                  static_cast<std::size_t>(std::distance(b.begin_right(), b.lower_bound_right(k))));
+    }
+    EXPECT_THROW(m.at_left(-1), std::out_of_range);
+
+    mapped_bimap<int, int> moved(std::move(m));
+    EXPECT_EQ(moved.at_left(*b.begin_left()), *b.begin_left().flip());
+    EXPECT_THROW((mapped_bimap<int, long long>(path)), std::runtime_error);
+    EXPECT_THROW((mapped_bimap<int, int>(path + ".missing")), std::system_error);
+
+    // The second index of left_to_right is replaced by one out of range, then by a copy of the first one
+    intrusive::image_layout layout(b.size(), sizeof(int), sizeof(int));
+    std::uint32_t first = static_cast<std::uint32_t>(std::distance(b.begin_right(), b.begin_left().flip()));
+    for (std::uint32_t index : {static_cast<std::uint32_t>(b.size()), first}) {
+        {
+            std::fstream corrupt(path, std::ios::binary | std::ios::in | std::ios::out);
+            corrupt.seekp(static_cast<std::streamoff>(layout.left_to_right + sizeof(std::uint32_t)));
+            corrupt.write(reinterpret_cast<char const *>(&index), sizeof(index));
+        }
+        EXPECT_THROW((mapped_bimap<int, int>(path)), std::runtime_error);
+    }
+    std::remove(path.c_str());
+}
+
+namespace {
+    struct ranked_wavl : intrusive::wavl_policy {
+        static constexpr bool order_statistics = true;
+    };
+}
+
+TEST(bimap_randomized, wavl_matches_treap) {
+    using wavl = bimap<int, int, std::less<int>, std::less<int>, intrusive::slab_allocator<std::pair<int, int>>,
+            ranked_wavl>;
+    auto same = [](wavl const &a, bimap<int, int> const &b) {
+        ASSERT_EQ(a.size(), b.size());
+        auto it = a.begin_left();
+        for (auto jt = b.begin_left(); jt != b.end_left(); ++it, ++jt) {
+            ASSERT_EQ(*it, *jt);
+            ASSERT_EQ(*it.flip(), *jt.flip());
+        }
+        auto rt = a.begin_right();
+        for (auto jt = b.begin_right(); jt != b.end_right(); ++rt, ++jt) {
+            ASSERT_EQ(*rt, *jt);
+            ASSERT_EQ(rt.index(), static_cast<std::size_t>(std::distance(b.begin_right(), jt)));
+        }
+    };
+
+    std::mt19937 e(seed);
+    std::vector<std::pair<int, int>> pairs;
+    for (int i = 0; i < 2000; i++) {
+        pairs.emplace_back(static_cast<int>(e() % 5000), static_cast<int>(e() % 5000));
+    }
+    wavl w(pairs.begin(), pairs.end());
+    bimap<int, int> t(pairs.begin(), pairs.end());
+    same(w, t);
+
+    for (int i = 0; i < 20000; i++) {
+        int l = static_cast<int>(e() % 5000), r = static_cast<int>(e() % 5000);
+        switch (e() % 5) {
+            case 0:
+            case 1:
+                EXPECT_EQ(w.insert(l, r) == w.end_left(), t.insert(l, r) == t.end_left());
+                break;
+            case 2:
+                EXPECT_EQ(w.erase_left(l), t.erase_left(l));
+                break;
+            case 3:
+                EXPECT_EQ(w.erase_right(r), t.erase_right(r));
+                break;
+            default:
+                if (!t.empty()) {
+                    std::size_t k = e() % t.size();
+                    w.erase_left(w.nth_left(k));
+                    t.erase_left(std::next(t.begin_left(), k));
+                }
+        }
+    }
+    same(w, t);
+
+    w.erase_left(w.lower_bound_left(1000), w.lower_bound_left(2000));
+    t.erase_left(t.lower_bound_left(1000), t.lower_bound_left(2000));
+    same(w, t);
+
+    wavl copy(w);
+    same(copy, t);
+    std::stringstream image;
+    w.save(image);
+    same(wavl::load(image), t);
+
+    // Small and comparable merges take different paths
+    for (std::size_t n : {10, 3000}) {
+        wavl wo;
+        bimap<int, int> to;
+        for (std::size_t i = 0; i < n; i++) {
+            int l = static_cast<int>(e() % 10000), r = static_cast<int>(e() % 10000);
+            wo.insert(l, r);
+            to.insert(l, r);
+        }
+        w.merge(std::move(wo));
+        t.merge(std::move(to));
+        same(w, t);
+    }
+    for (int i = 0; i < 2000; i++) {
+        int l = static_cast<int>(e() % 10000);
+        EXPECT_EQ(w.erase_left(l), t.erase_left(l));
+    }
+    same(w, t);
+}